@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_ALLOC_H
+#define DS_ALLOC_H
+#include <stddef.h>
+
+/*
+ * Allocator interface for the containers (vec, str, hashmap). A NULL
+ * allocator pointer selects the default, which uses malloc/realloc/free.
+ * The sizes of the blocks are passed back to the allocator, so that e.g. size
+ * class or arena allocators do not need to store them in a block header.
+ */
+struct allocator {
+	void *(*alloc)(void *ctx, size_t size);
+	/* ptr may be NULL (with old_size 0), then this acts like alloc */
+	void *(*realloc)(void *ctx, void *ptr, size_t old_size,
+		size_t new_size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+#endif
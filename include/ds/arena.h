@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_ARENA_H
+#define DS_ARENA_H
+#include <stddef.h>
+#include <ds/alloc.h>
+
+/*
+ * Bump allocator over a list of chunks. Everything allocated from an arena is
+ * released at once, by arena_rewind or arena_finish.
+ *
+ * a->alloc is a struct allocator backed by the arena, so that vecs, strs and
+ * hashmaps can live in it. Through it, growing the most recent allocation
+ * happens in place when the chunk has room, and freeing the most recent
+ * allocation gives the space back; other frees are no-ops. Since a->alloc
+ * points to the arena, the arena must not be moved after arena_init.
+ */
+struct arena_chunk;
+struct arena {
+	struct arena_chunk *chunk; /* current, linked to the older ones */
+	size_t chunk_size;
+	struct allocator alloc;
+};
+struct arena_mark {
+	struct arena_chunk *chunk;
+	size_t used;
+};
+
+/* chunk_size 0 selects a default of 64 KiB */
+void arena_init(struct arena *a, size_t chunk_size);
+void arena_finish(struct arena *a);
+/* Returns memory aligned for any type, or NULL if out of memory. */
+void *arena_alloc(struct arena *a, size_t size);
+struct arena_mark arena_mark(const struct arena *a);
+/* Releases everything allocated since m was taken. */
+void arena_rewind(struct arena *a, struct arena_mark m);
+
+/* The arena of the calling thread, initialized on first use. Its chunks are
+ * only released by an explicit arena_finish(arena_thread()). */
+struct arena *arena_thread(void);
+
+#endif
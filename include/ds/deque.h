@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_DEQUE_H
+#define DS_DEQUE_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <ds/vec.h>
+
+/*
+ * Double-ended queue in a ring buffer. The storage is a vec whose cap is a
+ * power of two (or 0), v.len is the number of elements, and the element i is
+ * at index (head + i) & (cap - 1). Pushing and popping at either end is O(1);
+ * when the ring is full it doubles, and the wrapped part is moved once.
+ */
+struct deque {
+	struct vec v;
+	int head;
+};
+
+struct deque deque_new(size_t itemsize, const struct allocator *alloc);
+void deque_free(struct deque *q);
+void deque_clear(struct deque *q);
+int deque_len(const struct deque *q);
+/* the element i from the front */
+void * deque_get(struct deque *q, int i);
+/* make room for cap elements in total */
+bool deque_reserve(struct deque *q, int cap);
+bool deque_push_back(struct deque *q, const void *n);
+bool deque_push_front(struct deque *q, const void *n);
+/* Copies the removed element to out, unless it is NULL. Returns false if the
+ * deque was empty. */
+bool deque_pop_front(struct deque *q, void *out);
+bool deque_pop_back(struct deque *q, void *out);
+/* Appends the l elements of n to the back, copying at most two spans. */
+bool deque_push_back_multiple(struct deque *q, const void *n, int l);
+/* Removes up to l elements from the front (copying them to out unless it is
+ * NULL), returns the number of removed elements. */
+int deque_pop_front_multiple(struct deque *q, void *out, int l);
+
+/*
+ * Bounded single-producer/single-consumer ring for passing items between two
+ * threads without locks. One thread may push, and another one pop,
+ * concurrently. The capacity is fixed at init (rounded up to a power of two).
+ * Each index is written by one side only, and the two are kept on separate
+ * cache lines, along with a cached copy of the other side's index.
+ */
+#define SPSC_RING_ALIGN 64
+struct spsc_ring {
+	char *d;
+	size_t itemsize;
+	unsigned mask;
+	const struct allocator *alloc;
+	_Alignas(SPSC_RING_ALIGN) atomic_uint tail; /* written by the producer */
+	unsigned head_cache;
+	_Alignas(SPSC_RING_ALIGN) atomic_uint head; /* written by the consumer */
+	unsigned tail_cache;
+};
+
+bool spsc_ring_init(struct spsc_ring *r, size_t itemsize, int cap,
+	const struct allocator *alloc);
+void spsc_ring_finish(struct spsc_ring *r);
+/* Producer side. Returns false if the ring is full. */
+bool spsc_ring_push(struct spsc_ring *r, const void *n);
+/* Pushes up to l elements, returns the number pushed. */
+int spsc_ring_push_multiple(struct spsc_ring *r, const void *n, int l);
+/* Consumer side. Returns false if the ring is empty. */
+bool spsc_ring_pop(struct spsc_ring *r, void *out);
+/* Pops up to l elements into out, returns the number popped. */
+int spsc_ring_pop_multiple(struct spsc_ring *r, void *out, int l);
+
+#endif
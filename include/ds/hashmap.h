@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <ds/alloc.h>
 
 #define MAP_MISSING -3  /* No such element */
 #define MAP_FULL -2 	/* Hashmap is full */
@@ -20,6 +21,7 @@ struct hashmap {
 	uint32_t table_size;
 	int size;
 	size_t itemsize;
+	const struct allocator *alloc; /* NULL: malloc */
 };
 
 struct hashmap_iter {
@@ -28,6 +30,8 @@ struct hashmap_iter {
 };
 
 void hashmap_init(struct hashmap *m, size_t itemsize);
+void hashmap_init_with_alloc(struct hashmap *m, size_t itemsize,
+	const struct allocator *alloc);
 struct hashmap_iter hashmap_iter(struct hashmap *m);
 int hashmap_put(struct hashmap *m, struct hashmap_buffer key, void *value);
 int hashmap_get(struct hashmap *m, struct hashmap_buffer key, void **arg);
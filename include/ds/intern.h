@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_INTERN_H
+#define DS_INTERN_H
+#include <stdbool.h>
+#include <ds/hashmap.h>
+#include <ds/iter.h>
+#include <ds/vec.h>
+
+/*
+ * String interning table. Each distinct string is copied once into an arena
+ * of chunks that never move, and gets a small integer atom (0, 1, 2, ...).
+ * The canonical copies are '\0' terminated and stay valid until
+ * intern_finish, so two interned strings are equal iff their atoms (or
+ * canonical pointers) are equal.
+ */
+struct intern {
+	struct hashmap map; /* canonical bytes -> uint32_t atom */
+	struct vec atoms; /* struct str_slice, indexed by atom */
+	struct vec chunks; /* char *, the arena */
+	char *cur;
+	int cur_left;
+};
+
+void intern_init(struct intern *in);
+void intern_finish(struct intern *in);
+/* Returns the atom of s, interning it if needed, or -1 if out of memory. */
+int intern_slice(struct intern *in, struct str_slice s);
+int intern_cstr(struct intern *in, const char *cstr);
+/* Returns the atom of s, or -1 if it was never interned. */
+int intern_find(struct intern *in, struct str_slice s);
+/* The canonical copy of an atom. */
+struct str_slice intern_get(const struct intern *in, int atom);
+int intern_count(const struct intern *in);
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef DS_ITER_H
 #define DS_ITER_H
 #include <stdbool.h>
+#include <stdint.h>
 #include <ds/vec.h>
 
 struct str_slice {
@@ -12,20 +13,221 @@ struct str_slice {
 struct str_slice str_as_slice(const struct str *str);
 struct str str_new_from_slice(struct str_slice s);
 
+/* multi-pattern matcher, see str_matcher_init */
+struct str_matcher {
+	struct vec nodes;
+	struct vec lens; /* int, the pattern lengths */
+};
+
 struct str_gen {
 	enum str_gen_kind {
 		STR_GEN_KIND_SPLIT,
+		STR_GEN_KIND_CSV,
+		STR_GEN_KIND_SPLIT_FD,
+		STR_GEN_KIND_SPLIT_MMAP,
+		STR_GEN_KIND_SPLIT_MEM,
+		STR_GEN_KIND_TRIM,
+		STR_GEN_KIND_NONEMPTY,
+		STR_GEN_KIND_TAKE,
+		STR_GEN_KIND_SKIP,
+		STR_GEN_KIND_SPLIT_EACH,
+		STR_GEN_KIND_FIND,
+		STR_GEN_KIND_FIND_ANY,
+		STR_GEN_KIND_CODEPOINTS,
 	} kind;
 	union {
-		struct {
+		struct str_gen_split {
 			struct str_slice s;
 			char c;
 			int i;
 		} split;
+		struct {
+			struct str_slice s;
+			char sep;
+			int i;
+			bool pending; /* read a separator, a field follows */
+			bool escaped, end_of_record; /* of the last field */
+		} csv;
+		struct str_gen_fd {
+			int fd;
+			char c;
+			char *buf;
+			/* buf[start, end) is unread, no c in [start, scan) */
+			int cap, start, scan, end;
+			bool eof, done, error;
+		} split_fd;
+		struct str_gen_mmap {
+			const char *d;
+			size_t len, i;
+			char c;
+		} split_mmap; /* also for STR_GEN_KIND_SPLIT_MEM */
+		struct {
+			struct str_gen *src;
+			int n;
+		} pipe;
+		struct {
+			struct str_gen *src;
+			struct str_gen_split cur; /* splitting a piece of src */
+		} split_each;
+		struct {
+			struct str_slice s, needle;
+			int i;
+		} find;
+		struct {
+			const struct str_matcher *m;
+			struct str_slice s;
+			int i, state;
+			int pending; /* node with matches to report, or -1 */
+			int pattern; /* of the last match */
+		} find_any;
+		struct {
+			struct str_slice s;
+			int i;
+			int32_t cp; /* the last codepoint */
+		} codepoints;
 	};
 };
 
 bool str_gen_next(struct str_gen *g, struct str_slice *res);
+/* Splits s at every c: n occurrences of c give n + 1 (possibly empty)
+ * pieces. The delimiters are found with memchr. */
 struct str_gen str_gen_split(struct str_slice s, char c);
+/* Continues a split generator, filling out with up to n pieces at a time.
+ * Returns the number of pieces written, 0 once the generator is done. The
+ * delimiters are located 64 bytes at a time, as a bitmask (with SSE2 where
+ * available). */
+int str_gen_split_bulk(struct str_gen *g, struct str_slice *out, int n);
+/* Splits d[0, len) like str_gen_split, for inputs of 2 GiB and more. A
+ * piece must still be shorter than 2 GiB. */
+struct str_gen str_gen_split_mem(const char *d, size_t len, char c);
+
+/*
+ * Streaming splits of files, with the same pieces as str_gen_split would give
+ * for the whole contents. The returned slices are only valid until the next
+ * call, and the generator must be released with str_gen_finish.
+ *
+ * str_gen_split_fd reads fd in chunks of chunk_size bytes (0 selects 1 MiB),
+ * so the memory use is bounded by the chunk size and the longest piece. After
+ * a read error the generator stops, with g->split_fd.error set.
+ *
+ * str_gen_split_mmap maps the file at path with a sequential access hint. A
+ * piece must be shorter than 2 GiB, the file itself can be larger.
+ */
+bool str_gen_split_fd(struct str_gen *g, int fd, char c, int chunk_size);
+bool str_gen_split_mmap(struct str_gen *g, const char *path, char c);
+/* Frees the resources of g. Needed for the streaming kinds, a no-op for the
+ * others. */
+void str_gen_finish(struct str_gen *g);
+
+/*
+ * Combinators, for building lazy pipelines of generators, e.g.:
+ *
+ *   struct str_gen lines = str_gen_split(s, '\n');
+ *   struct str_gen trimmed = str_gen_trim(&lines);
+ *   struct str_gen rows = str_gen_nonempty(&trimmed);
+ *   while (str_gen_next(&rows, &row)) ...
+ *
+ * Each stage pulls the pieces of src one at a time, so the whole pipeline runs
+ * in a single pass without allocating. The stages only point to their
+ * sources, which must outlive them (and be finished by the caller).
+ */
+/* the pieces of src, without leading and trailing whitespace */
+struct str_gen str_gen_trim(struct str_gen *src);
+/* the non-empty pieces of src */
+struct str_gen str_gen_nonempty(struct str_gen *src);
+/* the first n pieces of src */
+struct str_gen str_gen_take(struct str_gen *src, int n);
+/* the pieces of src after the first n */
+struct str_gen str_gen_skip(struct str_gen *src, int n);
+/* each piece of src split at c, flattened */
+struct str_gen str_gen_split_each(struct str_gen *src, char c);
+
+/*
+ * Substring search. str_find returns the index of the first occurrence of
+ * needle in hay at or after from, or -1. It does not need '\0' terminated
+ * data. Short needles are found by filtering the candidate positions on the
+ * first and last byte of the needle (16 at a time with SSE2), long ones with
+ * the Two-Way algorithm, in linear time.
+ */
+int str_find(struct str_slice hay, struct str_slice needle, int from);
+/* The non-overlapping occurrences of needle (not empty) in s, in order. */
+struct str_gen str_gen_find(struct str_slice s, struct str_slice needle);
+
+/*
+ * Aho-Corasick automaton for finding any of n (non-empty) patterns in a
+ * single pass. It takes 1 KiB per node (one for each distinct pattern
+ * prefix). Returns false if out of memory.
+ */
+bool str_matcher_init(struct str_matcher *m, const struct str_slice *patterns,
+	int n);
+void str_matcher_finish(struct str_matcher *m);
+/* All occurrences of the patterns of m in s, including overlapping ones,
+ * ordered by their end, and longest first for the same end. m must outlive
+ * the generator. */
+struct str_gen str_gen_find_any(struct str_slice s,
+	const struct str_matcher *m);
+/* the index of the pattern last returned by str_gen_next */
+int str_gen_find_any_pattern(const struct str_gen *g);
+
+/*
+ * UTF-8 validation: rejects overlong forms, surrogates, values over U+10FFFF
+ * and truncated sequences. Uses the SIMD algorithm of Keiser and Lemire where
+ * the CPU has SSSE3 (checked at runtime), 32 bytes per step for ASCII.
+ */
+bool str_slice_utf8_valid(struct str_slice s);
+bool str_utf8_valid(const struct str *s);
+
+/*
+ * The codepoints of s, each as the slice of its encoding; the decoded value
+ * is given by str_gen_codepoint. An invalid byte is returned on its own, with
+ * the codepoint -1.
+ */
+struct str_gen str_gen_codepoints(struct str_slice s);
+int32_t str_gen_codepoint(const struct str_gen *g);
+/* Continues a codepoints generator, filling out with up to n decoded
+ * codepoints at a time (-1 for invalid bytes), and without their slices.
+ * Returns the number written, 0 once the generator is done. Runs of ASCII are
+ * widened 16 bytes at a time (with SSE2 where available). */
+int str_gen_codepoints_bulk(struct str_gen *g, int32_t *out, int n);
+
+/*
+ * Parallel splitting of large inputs. d[0, len) is cut at delimiters into up
+ * to nthreads chunks of about the same size, and each chunk is split on its
+ * own thread. Inputs under 1 MiB are split on the calling thread. The input
+ * may be larger than 2 GiB, a piece may not.
+ *
+ * str_split_parallel appends the pieces, as struct str_slice, to out. They
+ * are the same, and in the same order, as the ones of str_gen_split. The
+ * threads first count their pieces, then out is grown once on the calling
+ * thread (so out->alloc does not have to be thread safe), and the threads
+ * write their pieces directly into it. Returns false if out of memory, or if
+ * out would have more than INT_MAX pieces, then out is unchanged.
+ *
+ * str_split_parallel_each calls fn concurrently, once for each chunk, with
+ * the chunk index (in input order) and a str_gen_split_mem generator over
+ * the chunk. Returns the number of chunks.
+ */
+bool str_split_parallel(const char *d, size_t len, char c, int nthreads,
+	struct vec *out);
+int str_split_parallel_each(const char *d, size_t len, char c, int nthreads,
+	void (*fn)(void *env, int chunk, struct str_gen *g), void *env);
+
+/*
+ * Tokenizes RFC 4180 CSV (sep ',') or TSV (sep '\t') into fields, without
+ * copying. Records end at "\n", "\r\n" or a lone "\r"; a line break at the
+ * end of the input does not start a new record. A quoted field is returned
+ * without its outer quotes, and may still contain doubled quotes: check
+ * str_gen_csv_escaped, and only then unescape it with str_csv_unescape.
+ * Malformed input is accepted: an unterminated quote runs to the end of the
+ * input, and text after a closing quote is dropped.
+ */
+struct str_gen str_gen_csv(struct str_slice s, char sep);
+/* whether the field last returned by str_gen_next ended its record */
+bool str_gen_csv_end_of_record(const struct str_gen *g);
+/* whether the field last returned by str_gen_next contains "" escapes */
+bool str_gen_csv_escaped(const struct str_gen *g);
+/* Writes field with the "" escapes replaced by ", to out (which has room for
+ * field.len bytes), and returns the unescaped length. */
+int str_csv_unescape(struct str_slice field, char *out);
 
 #endif
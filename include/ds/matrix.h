@@ -14,6 +14,39 @@ void mat3_rot(float m[static 9], float a);
 /* Project a left handed coordinate system to NDC. */
 void mat3_proj(float m[static 9], const int size[static 2]);
 
+/*
+ * Affine transforms as the upper two rows of a mat3, with the last row being
+ * implicitly (0, 0, 1). The operations are the same as the mat3 ones, in
+ * closed form. mat2x3_invert returns false if m is singular.
+ */
+void mat2x3_ident(float m[static 6]);
+/* A <- B * A */
+void mat2x3_mul_l(float A[static 6], const float B[static 6]);
+void mat2x3_tran(float m[static 6], const float t[static 2]);
+void mat2x3_scale(float m[static 6], const float s[static 2]);
+void mat2x3_rot(float m[static 6], float a);
+bool mat2x3_invert(float out[static 6], const float m[static 6]);
+void mat2x3_to_mat3(float out[static 9], const float m[static 6]);
+/* like mat3_apply_affine */
+void mat2x3_apply(const float m[static 6], float *out, const float *in,
+	int n);
+
+/*
+ * Transform n points by m, as column vectors (x, y, 1). The projective
+ * variants divide by the resulting third component, the affine ones ignore
+ * the last row of m. AoS points are interleaved x0 y0 x1 y1 ..., SoA points
+ * are separate x and y arrays. The output may be the same as the input.
+ * Uses AVX and FMA when the CPU has them (checked at runtime), SSE otherwise,
+ * so the results can differ from scalar code in the last bit.
+ */
+void mat3_apply(const float m[static 9], float *out, const float *in, int n);
+void mat3_apply_affine(const float m[static 9], float *out, const float *in,
+	int n);
+void mat3_apply_soa(const float m[static 9], float *out_x, float *out_y,
+	const float *x, const float *y, int n);
+void mat3_apply_affine_soa(const float m[static 9], float *out_x,
+	float *out_y, const float *x, const float *y, int n);
+
 bool aabb_contains(const float aabb[static 4], const float p[static 2]);
 void aabb_intersect(float out[static 4], const float a[static 4],
 	const float b[static 4]);
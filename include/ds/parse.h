@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_PARSE_H
+#define DS_PARSE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <ds/iter.h>
+#include <ds/vec.h>
+
+/*
+ * Number parsing directly on slices, without '\0' terminated copies. The
+ * whole slice must be the number: no surrounding whitespace, no trailing
+ * characters. Returns false on invalid input or overflow.
+ *
+ * Integers are decimal, with an optional sign for the signed ones. Runs of
+ * eight digits are converted at once, with SWAR arithmetic on a 64-bit word.
+ *
+ * Floats are [+-]digits[.digits][(e|E)[+-]digits] (where one of the digit
+ * runs may be empty), and, through strtod, the other forms it accepts (inf,
+ * nan, hex floats) up to 127 characters. Values that overflow to infinity
+ * are rejected, the ones that underflow give 0 or a subnormal. The result is
+ * correctly rounded: up to 19 significant digits with an exact power of ten
+ * are computed exactly in double arithmetic, the rest with the Eisel-Lemire
+ * algorithm (a 128-bit multiplication by a table of powers of five). Only
+ * when more digits are needed to decide the rounding, a shortened copy is
+ * handed to strtod. Nothing is allocated.
+ */
+bool str_parse_u64(struct str_slice s, uint64_t *out);
+bool str_parse_i64(struct str_slice s, int64_t *out);
+bool str_parse_double(struct str_slice s, double *out);
+
+/*
+ * Parse a column of fields (a vec of struct str_slice, as given by
+ * str_split_parallel) and append the values to out (a vec of int64_t or
+ * double). On an invalid field, returns false with its index in *bad, and
+ * the values before it appended. If out of memory, returns false with *bad
+ * -1, and out unchanged.
+ */
+bool str_parse_i64_column(const struct vec *fields, struct vec *out, int *bad);
+bool str_parse_double_column(const struct vec *fields, struct vec *out,
+	int *bad);
+
+#endif
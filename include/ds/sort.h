@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_SORT_H
+#define DS_SORT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <ds/vec.h>
+
+/*
+ * Sorting and searching for arrays and vecs.
+ *
+ * DS_SORT_DEFINE(name, type, lt) defines static inline functions for arrays
+ * of `type`, with the comparison lt(a, b) (a < b, taking two values; a macro
+ * or an inline function) inlined into them:
+ *
+ *   void name(type *a, int n);
+ *     pattern-defeating quicksort (pdqsort), not stable
+ *   int name_lower_bound(const type *a, int n, type key);
+ *     index of the first element that is not less than key (n if none)
+ *
+ * Use them on a vec as name(v.d, v.len).
+ *
+ * The vec_* functions below take a qsort style comparator instead, and work
+ * for any itemsize.
+ */
+
+/* pdqsort, see: Orson R. L. Peters, "Pattern-defeating Quicksort",
+ * https://arxiv.org/abs/2106.05123 */
+#define DS_SORT_INSERTION_THRESHOLD 24
+#define DS_SORT_NINTHER_THRESHOLD 128
+#define DS_SORT_PARTIAL_INSERTION_LIMIT 8
+
+#define DS_SORT_DEFINE(name, type, lt) \
+static inline void name##_swap_(type *a, type *b) { \
+	type t = *a; *a = *b; *b = t; \
+} \
+static inline void name##_sort2_(type *a, type *b) { \
+	if (lt(*b, *a)) name##_swap_(a, b); \
+} \
+static inline void name##_sort3_(type *a, type *b, type *c) { \
+	name##_sort2_(a, b); \
+	name##_sort2_(b, c); \
+	name##_sort2_(a, b); \
+} \
+/* unguarded: the element before begin is not greater than any in range */ \
+static inline void name##_insertion_(type *begin, type *end, \
+		bool unguarded) { \
+	if (begin == end) return; \
+	for (type *cur = begin + 1; cur != end; ++cur) { \
+		if (!lt(*cur, cur[-1])) continue; \
+		type tmp = *cur; \
+		type *sift = cur; \
+		do { \
+			*sift = sift[-1]; \
+			--sift; \
+		} while ((unguarded || sift != begin) && lt(tmp, sift[-1])); \
+		*sift = tmp; \
+	} \
+} \
+/* gives up (returning false) after moving too many elements */ \
+static inline bool name##_partial_insertion_(type *begin, type *end) { \
+	if (begin == end) return true; \
+	int moved = 0; \
+	for (type *cur = begin + 1; cur != end; ++cur) { \
+		if (!lt(*cur, cur[-1])) continue; \
+		type tmp = *cur; \
+		type *sift = cur; \
+		do { \
+			*sift = sift[-1]; \
+			--sift; \
+		} while (sift != begin && lt(tmp, sift[-1])); \
+		*sift = tmp; \
+		moved += cur - sift; \
+		if (moved > DS_SORT_PARTIAL_INSERTION_LIMIT) return false; \
+	} \
+	return true; \
+} \
+static inline void name##_sift_down_(type *a, int i, int n) { \
+	type tmp = a[i]; \
+	for (;;) { \
+		int c = 2 * i + 1; \
+		if (c >= n) break; \
+		if (c + 1 < n && lt(a[c], a[c + 1])) ++c; \
+		if (!lt(tmp, a[c])) break; \
+		a[i] = a[c]; \
+		i = c; \
+	} \
+	a[i] = tmp; \
+} \
+static inline void name##_heapsort_(type *a, int n) { \
+	for (int i = n / 2 - 1; i >= 0; --i) name##_sift_down_(a, i, n); \
+	for (int i = n - 1; i > 0; --i) { \
+		name##_swap_(&a[0], &a[i]); \
+		name##_sift_down_(a, 0, i); \
+	} \
+} \
+/* Partitions around the pivot *begin, elements equal to it go right. \
+ * Returns the final position of the pivot. */ \
+static inline type *name##_partition_right_(type *begin, type *end, \
+		bool *already_partitioned) { \
+	type pivot = *begin; \
+	type *first = begin, *last = end; \
+	while (lt(*++first, pivot)); \
+	if (first - 1 == begin) { \
+		while (first < last && !lt(*--last, pivot)); \
+	} else { \
+		while (!lt(*--last, pivot)); \
+	} \
+	*already_partitioned = first >= last; \
+	while (first < last) { \
+		name##_swap_(first, last); \
+		while (lt(*++first, pivot)); \
+		while (!lt(*--last, pivot)); \
+	} \
+	type *pivot_pos = first - 1; \
+	*begin = *pivot_pos; \
+	*pivot_pos = pivot; \
+	return pivot_pos; \
+} \
+/* Like partition_right, but elements equal to the pivot go left. Used when \
+ * the pivot equals the element before the range, then the left part is all \
+ * equal and needs no more sorting. */ \
+static inline type *name##_partition_left_(type *begin, type *end) { \
+	type pivot = *begin; \
+	type *first = begin, *last = end; \
+	while (lt(pivot, *--last)); \
+	if (last + 1 == end) { \
+		while (first < last && !lt(pivot, *++first)); \
+	} else { \
+		while (!lt(pivot, *++first)); \
+	} \
+	while (first < last) { \
+		name##_swap_(first, last); \
+		while (lt(pivot, *--last)); \
+		while (!lt(pivot, *++first)); \
+	} \
+	type *pivot_pos = last; \
+	*begin = *pivot_pos; \
+	*pivot_pos = pivot; \
+	return pivot_pos; \
+} \
+static void name##_loop_(type *begin, type *end, int bad_allowed, \
+		bool leftmost) { \
+	for (;;) { \
+		int size = end - begin; \
+		if (size < DS_SORT_INSERTION_THRESHOLD) { \
+			name##_insertion_(begin, end, !leftmost); \
+			return; \
+		} \
+		int s2 = size / 2; \
+		if (size > DS_SORT_NINTHER_THRESHOLD) { \
+			name##_sort3_(begin, begin + s2, end - 1); \
+			name##_sort3_(begin + 1, begin + (s2 - 1), end - 2); \
+			name##_sort3_(begin + 2, begin + (s2 + 1), end - 3); \
+			name##_sort3_(begin + (s2 - 1), begin + s2, \
+				begin + (s2 + 1)); \
+			name##_swap_(begin, begin + s2); \
+		} else { \
+			name##_sort3_(begin + s2, begin, end - 1); \
+		} \
+		if (!leftmost && !lt(begin[-1], *begin)) { \
+			begin = name##_partition_left_(begin, end) + 1; \
+			continue; \
+		} \
+		bool already; \
+		type *p = name##_partition_right_(begin, end, &already); \
+		int l = p - begin, r = end - (p + 1); \
+		if (l < size / 8 || r < size / 8) { \
+			/* bad split, shuffle some elements around */ \
+			if (--bad_allowed == 0) { \
+				name##_heapsort_(begin, size); \
+				return; \
+			} \
+			if (l >= DS_SORT_INSERTION_THRESHOLD) { \
+				name##_swap_(begin, begin + l / 4); \
+				name##_swap_(p - 1, p - l / 4); \
+				if (l > DS_SORT_NINTHER_THRESHOLD) { \
+					name##_swap_(begin + 1, \
+						begin + (l / 4 + 1)); \
+					name##_swap_(begin + 2, \
+						begin + (l / 4 + 2)); \
+					name##_swap_(p - 2, p - (l / 4 + 1)); \
+					name##_swap_(p - 3, p - (l / 4 + 2)); \
+				} \
+			} \
+			if (r >= DS_SORT_INSERTION_THRESHOLD) { \
+				name##_swap_(p + 1, p + (1 + r / 4)); \
+				name##_swap_(end - 1, end - r / 4); \
+				if (r > DS_SORT_NINTHER_THRESHOLD) { \
+					name##_swap_(p + 2, p + (2 + r / 4)); \
+					name##_swap_(p + 3, p + (3 + r / 4)); \
+					name##_swap_(end - 2, \
+						end - (1 + r / 4)); \
+					name##_swap_(end - 3, \
+						end - (2 + r / 4)); \
+				} \
+			} \
+		} else if (already && name##_partial_insertion_(begin, p) \
+				&& name##_partial_insertion_(p + 1, end)) { \
+			/* probably already sorted, and it turned out so */ \
+			return; \
+		} \
+		name##_loop_(begin, p, bad_allowed, leftmost); \
+		begin = p + 1; \
+		leftmost = false; \
+	} \
+} \
+static inline void name(type *a, int n) { \
+	int log2n = 0; \
+	while ((1 << log2n) < n) ++log2n; \
+	name##_loop_(a, a + n, log2n + 1, true); \
+} \
+static inline int name##_lower_bound(const type *a, int n, type key) { \
+	const type *base = a; \
+	while (n > 0) { \
+		int half = n / 2; \
+		if (lt(base[half], key)) { \
+			base += half + 1; \
+			n -= half + 1; \
+		} else { \
+			n = half; \
+		} \
+	} \
+	return base - a; \
+}
+
+/* Same algorithm as DS_SORT_DEFINE, through a comparator function. */
+void vec_sort(struct vec *v, int (*cmp)(const void *a, const void *b));
+
+/* Index of the first element e with cmp(e, key) >= 0, or v->len. */
+int vec_lower_bound(const struct vec *v, const void *key,
+	int (*cmp)(const void *a, const void *b));
+/* Index of an element equal to key, or -1. */
+int vec_bsearch(const struct vec *v, const void *key,
+	int (*cmp)(const void *a, const void *b));
+
+/*
+ * Stable LSD radix sort on an unsigned (or two's complement, if is_signed)
+ * integer key of key_size (1, 2, 4 or 8) bytes, stored in native byte order
+ * at key_offset in each element. Byte positions that are the same in all the
+ * keys are skipped. Returns false if the temporary buffer could not be
+ * allocated (through v->alloc), then v is unchanged.
+ */
+bool vec_radix_sort(struct vec *v, size_t key_offset, size_t key_size,
+	bool is_signed);
+
+/*
+ * Sorts with up to nthreads threads: the chunks are sorted concurrently with
+ * vec_sort, then merged pairwise, each level of merges running in parallel.
+ * Not stable. Small vecs are sorted on the calling thread, and so is
+ * everything if the merge buffer cannot be allocated (through v->alloc); work
+ * for a thread that cannot be started is done on the calling thread too.
+ */
+void vec_sort_parallel(struct vec *v,
+	int (*cmp)(const void *a, const void *b), int nthreads);
+
+#endif
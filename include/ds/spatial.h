@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_SPATIAL_H
+#define DS_SPATIAL_H
+#include <stdbool.h>
+#include <ds/alloc.h>
+#include <ds/vec.h>
+
+/*
+ * Spatial indexes over boxes [x, y, w, h], with the semantics of aabb_contains
+ * and aabb_intersect in matrix.h: a box contains the points of
+ * [x, x + w) x [y, y + h), and two boxes intersect if their intersection has
+ * a positive area. Boxes are identified by their index in the input (tree)
+ * or the id returned on insertion (grid).
+ *
+ * Queries append the matching indices to out (a vec of int) in no particular
+ * order. The nearest queries append up to k indices ordered by the distance
+ * of p to the closed box [x, x + w] x [y, y + h], closest first (ties in no
+ * particular order). All of them return false if out could not grow.
+ */
+
+/*
+ * Static packed Hilbert R-tree. The boxes are sorted by the Hilbert curve
+ * index of their centers, and packed into nodes of AABB_TREE_NODE_SIZE
+ * entries, then the nodes into parent nodes the same way, up to a single
+ * root. The entries of a node are tested together with SSE when available.
+ * The boxes are copied, later changes to them are not seen by the tree.
+ */
+#define AABB_TREE_NODE_SIZE 16
+struct aabb_tree {
+	struct vec nodes; /* leaves first, the root is the last one */
+	int leaves;
+};
+/* boxes holds n boxes, 4 floats each */
+bool aabb_tree_build(struct aabb_tree *t, const float *boxes, int n,
+	const struct allocator *alloc);
+void aabb_tree_finish(struct aabb_tree *t);
+bool aabb_tree_query_point(const struct aabb_tree *t, const float p[static 2],
+	struct vec *out);
+bool aabb_tree_query_rect(const struct aabb_tree *t, const float r[static 4],
+	struct vec *out);
+bool aabb_tree_nearest(const struct aabb_tree *t, const float p[static 2],
+	int k, struct vec *out);
+
+/*
+ * Uniform grid for dynamic sets of boxes. The area bounds [x, y, w, h] is
+ * divided into square cells of size cell, and each box is listed in every
+ * cell it overlaps. Boxes (partly) outside of bounds are listed in the
+ * border cells, so they are still found, only less efficiently. The ids of
+ * removed boxes are reused by later insertions.
+ */
+struct aabb_grid {
+	float bounds[4], cell;
+	int cols, rows;
+	struct vec cells; /* a vec of ids for each cell, row by row */
+	struct vec entries; /* indexed by id */
+	struct vec free_ids;
+};
+/* cell > 0. Returns false if out of memory, or if there would be more than
+ * INT_MAX cells. */
+bool aabb_grid_init(struct aabb_grid *g, const float bounds[static 4],
+	float cell, const struct allocator *alloc);
+void aabb_grid_finish(struct aabb_grid *g);
+/* returns the id of the box, or -1 */
+int aabb_grid_insert(struct aabb_grid *g, const float box[static 4]);
+/* id must be of a box in the grid */
+void aabb_grid_remove(struct aabb_grid *g, int id);
+/* On failure the box is left at its old place. */
+bool aabb_grid_move(struct aabb_grid *g, int id, const float box[static 4]);
+bool aabb_grid_query_point(const struct aabb_grid *g, const float p[static 2],
+	struct vec *out);
+bool aabb_grid_query_rect(const struct aabb_grid *g, const float r[static 4],
+	struct vec *out);
+bool aabb_grid_nearest(const struct aabb_grid *g, const float p[static 2],
+	int k, struct vec *out);
+
+#endif
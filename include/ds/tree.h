@@ -2,22 +2,38 @@
 #ifndef DS_TREE_H
 #define DS_TREE_H
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* red-black tree & interval tree */
 struct rb_node {
 	int color;
+	bool dirty; /* augment is stale, only used during batches */
 	struct rb_node *p;
 	union {
 		struct { struct rb_node *left, *right; };
 		struct rb_node *child[2];
 	};
 };
+/* The nodes of threaded trees embed this instead of a plain rb_node, the
+ * tree functions still take and return &x->node. */
+struct rb_threaded_node {
+	struct rb_node node;
+	/* in-order neighbours */
+	union {
+		struct { struct rb_node *prev, *next; };
+		struct rb_node *link[2];
+	};
+};
 struct rb_tree_ops;
 struct rb_tree {
 	struct rb_node *root;
 	struct rb_node nil;
 	struct rb_tree_ops *ops;
+	bool batch;
+	bool threaded;
+	/* the links of nil in threaded trees: the last and the first node */
+	struct rb_node *nil_link[2];
 };
 struct rb_tree_ops {
 	int (*lt)(struct rb_node *a, struct rb_node *b); /* op: a < b */
@@ -30,9 +46,28 @@ struct rb_tree_ops {
 	void (*update)(struct rb_tree *T, struct rb_node *x);
 };
 void rb_tree_init(struct rb_tree *T, struct rb_tree_ops *ops);
+/* A threaded tree additionally keeps its nodes in a doubly linked list (with
+ * T->nil as the head), so rb_successor, rb_predecessor and in-order iteration
+ * take O(1) steps. All of its nodes must be struct rb_threaded_node. */
+void rb_tree_init_threaded(struct rb_tree *T, struct rb_tree_ops *ops);
 void rb_insert(struct rb_tree *T, struct rb_node *z);
 void rb_delete(struct rb_tree *T, struct rb_node *z);
 
+/*
+ * Between rb_batch_begin and rb_batch_commit, rb_insert and rb_delete do not
+ * call ops->update, they only mark the affected nodes dirty. The commit then
+ * recomputes every dirty augment value once, bottom-up. Augment based queries
+ * (e.g. interval_iter) must not be used while a batch is open.
+ */
+void rb_batch_begin(struct rb_tree *T);
+void rb_batch_commit(struct rb_tree *T);
+
+/* Builds a balanced tree in O(n) out of n nodes that are already sorted
+ * according to ops->lt. Node i is found at (char *)nodes + i * stride. T must
+ * be empty. */
+void rb_build_sorted(struct rb_tree *T, struct rb_node *nodes, int n,
+	size_t stride);
+
 enum rb_iter_order {
 	RB_ITER_ORDER_IN,
 	RB_ITER_ORDER_POST,
@@ -50,7 +85,9 @@ struct rb_iter {
  * does not actually dereference them. */
 struct rb_iter rb_iter(struct rb_tree *T, enum rb_iter_order order);
 bool rb_iter_next(struct rb_iter *iter, struct rb_node **res);
+/* These return &T->nil if there is no such node. */
 struct rb_node *rb_successor(struct rb_tree *T, struct rb_node *x);
+struct rb_node *rb_predecessor(struct rb_tree *T, struct rb_node *x);
 
 struct rb_integer_node {
 	long long int val;
@@ -66,7 +103,9 @@ struct interval_node {
 		struct { long long int lo, hi; };
 		long long int ran[2];
 	};
-	long long int max_hi;
+	/* augment values, maintained by interval_ops */
+	long long int max_hi, min_hi;
+	int count;
 
 	struct rb_node node;
 };
@@ -91,4 +130,75 @@ bool interval_iter_next(struct interval_iter *iter,
 struct interval_node *interval_min_greater(struct rb_tree *T,
 	long long int min);
 
+/* Returns the number of intervals overlapping ran, without enumerating them.
+ * Subtrees whose intervals all overlap ran are counted as a whole, but the
+ * pruning only works on lo and the hi summaries, so nested intervals can make
+ * this visit O(n) nodes. Use interval_index for a strict O(log n) count. */
+int interval_count(struct rb_tree *T, const long long int ran[static 2]);
+
+/* Returns the length of the part of ran covered by the union of the
+ * intervals. This is an in-order walk over the intervals overlapping ran,
+ * skipping only those inside the already covered prefix: it takes O(k) steps
+ * for k disjoint pieces of coverage. Use interval_index_covered for an
+ * O(log n) query. */
+long long int interval_covered(struct rb_tree *T,
+	const long long int ran[static 2]);
+
+/*
+ * Interval tree with O(log n) overlap counting and coverage. Besides the
+ * usual interval tree by lo (usable with interval_iter etc.), both endpoints
+ * of every interval are kept as events in a second tree ordered by key, a lo
+ * before a hi at the same key.
+ *
+ * With lo <= hi for every interval, the intervals overlapping a non-empty
+ * [l, r) are those with lo < r, minus those with hi <= l, and both are
+ * counted along a single path with subtree counts. The number of intervals
+ * covering a point is the sum of the deltas (+1 for lo, -1 for hi) of the
+ * events before it. Each subtree of events keeps the minimum of that sum
+ * over the gaps between its events, and their total length where it is
+ * reached, so the uncovered length before a point is also found along a
+ * single path. Empty or inverted ranges give 0.
+ */
+struct interval_event {
+	long long int key;
+	int delta;
+	/* augment values, over the events of the subtree */
+	long long int min_key, max_key;
+	int sum, his; /* sum of the deltas, number of hi events */
+	int min_depth; /* INT_MAX if the subtree has a single event */
+	long long int min_len;
+	struct rb_node node;
+};
+struct interval_index_node {
+	struct interval_node iv;
+	struct interval_event ev[2]; /* at lo and at hi */
+};
+struct interval_index {
+	struct rb_tree by_lo, events;
+};
+void interval_index_init(struct interval_index *I);
+void interval_index_insert(struct interval_index *I,
+	struct interval_index_node *z);
+void interval_index_delete(struct interval_index *I,
+	struct interval_index_node *z);
+int interval_index_count(struct interval_index *I,
+	const long long int ran[static 2]);
+long long int interval_index_covered(struct interval_index *I,
+	const long long int ran[static 2]);
+
+/*
+ * Binary dumps of rb_integer_node and interval_node trees. The file is a small
+ * header followed by the keys in sorted order (native byte order), written by
+ * an in-order rb_iter pass. Loading maps the file and builds the tree with
+ * rb_build_sorted, recomputing the augment values on the way. The loaded nodes
+ * are returned in *nodes as a single allocation, to be released with free()
+ * once T is no longer used. T must be initialized and empty.
+ */
+bool rb_integer_save(struct rb_tree *T, const char *path);
+bool rb_integer_load(struct rb_tree *T, const char *path,
+	struct rb_integer_node **nodes, int *n);
+bool interval_save(struct rb_tree *T, const char *path);
+bool interval_load(struct rb_tree *T, const char *path,
+	struct interval_node **nodes, int *n);
+
 #endif
@@ -3,35 +3,100 @@
 #define DS_VEC_H
 #include <stddef.h>
 #include <stdbool.h>
+#include <ds/alloc.h>
 
 struct vec {
 	void *d;
 	int len, cap;
 	size_t itemsize;
+	const struct allocator *alloc; /* NULL: malloc */
 };
 #define VEC_EMPTY(is) \
 	(struct vec){ .d = NULL, .len = 0, .cap = 0, .itemsize = is }
 
+/*
+ * Strings of up to STR_INLINE_CAP bytes are stored inline, longer ones in the
+ * heap vec v. The inline buffer overlays v up to (not including) v.alloc, so
+ * the allocator is kept in both modes. Its last byte is the inline tag, which
+ * overlays a byte of v.itemsize (always 1 for strings) in heap mode. Use the
+ * str_* functions instead of accessing v directly.
+ */
+#define STR_INLINE_SIZE offsetof(struct vec, alloc)
+#define STR_INLINE_CAP (STR_INLINE_SIZE - 2)
 struct str {
-	struct vec v;
+	union {
+		struct vec v;
+		struct {
+			char d[STR_INLINE_SIZE - 1]; /* contents + '\0' */
+			unsigned char tag; /* inline flag | length */
+		} in;
+	};
 };
 extern const struct str str_empty;
 
+/*
+ * Functions that can grow the storage return false (or -1 for vec_append) if
+ * the allocation failed, in which case the container is left unchanged.
+ */
+
 struct str str_new_empty();
+struct str str_new_with_alloc(const struct allocator *alloc);
 struct str str_new_from_cstr(const char *cstr);
-void str_append(struct str *s, const char *n, int l);
-void str_append_char(struct str *s, char c);
+bool str_append(struct str *s, const char *n, int l);
+bool str_append_char(struct str *s, char c);
 const char * str_cstr(const struct str *s);
+int str_len(const struct str *s);
 struct str str_copy(const struct str *s);
 void str_free(struct str *s);
 bool str_any(const struct str *s);
 void str_clear(struct str *s);
+/* make room for cap bytes (plus the terminating '\0') */
+bool str_reserve(struct str *s, int cap);
+
+/*
+ * Chunked string builder for large outputs that are built from many appends.
+ * The data goes into a list of blocks (at least STR_BUILDER_BLOCK bytes each)
+ * so it is never moved once written. The result is either written out with
+ * writev, or flattened into a struct str with a single copy.
+ */
+#define STR_BUILDER_BLOCK (64 * 1024)
+struct str_builder_block;
+struct str_builder {
+	struct str_builder_block *head, *tail;
+	size_t len;
+	const struct allocator *alloc; /* NULL: malloc */
+};
+struct str_builder str_builder_new(const struct allocator *alloc);
+bool str_builder_append(struct str_builder *b, const char *n, size_t l);
+size_t str_builder_len(const struct str_builder *b);
+/* Writes everything to fd, retrying short writes. Returns false on error,
+ * with errno set by writev. */
+bool str_builder_write(const struct str_builder *b, int fd);
+/* *out gets the allocator of the builder */
+bool str_builder_flatten(const struct str_builder *b, struct str *out);
+void str_builder_free(struct str_builder *b);
 
 struct vec vec_new_empty(size_t itemsize);
-void vec_append_multiple(struct vec *v, const void *n, int l);
-/* return index of added element */
+struct vec vec_new_with_alloc(size_t itemsize,
+	const struct allocator *alloc);
+/* make room for cap elements in total */
+bool vec_reserve(struct vec *v, int cap);
+/* make room for l more elements, growing the capacity geometrically */
+bool vec_grow(struct vec *v, int l);
+bool vec_append_multiple(struct vec *v, const void *n, int l);
+/* return index of added element, or -1 */
 int vec_append(struct vec *v, const void *n);
 void vec_remove(struct vec *v, int i);
+/* O(1) remove, the last element takes the place of the removed one */
+void vec_swap_remove(struct vec *v, int i);
+/* remove the elements [i, i + l) */
+void vec_remove_range(struct vec *v, int i, int l);
+/* insert l elements from n before index i (i == len appends) */
+bool vec_insert_range(struct vec *v, int i, const void *n, int l);
+/* Keep only the elements for which keep returns true, preserving their
+ * order, in a single pass. Returns the number of removed elements. */
+int vec_retain(struct vec *v, bool (*keep)(const void *item, void *env),
+	void *env);
 void * vec_get(struct vec *v, int i);
 const void * vec_get_c(const struct vec *v, int i);
 void vec_free(struct vec *v);
@@ -39,4 +104,75 @@ void vec_clear(struct vec *v);
 struct vec vec_copy(const struct vec *v);
 bool vec_any(const struct vec *v);
 
+/*
+ * DS_VEC_DEFINE(name, type) defines struct name, a vec of `type` with a typed
+ * `type *d`, and static inline functions for it:
+ *
+ *   struct name name_new(const struct allocator *alloc);
+ *   type *name_get(struct name *v, int i);
+ *   bool name_push(struct name *v, type x);
+ *   type name_pop(struct name *v);
+ *   bool name_reserve(struct name *v, int cap);
+ *   void name_free(struct name *v);
+ *
+ * The element size is a constant in these, so indexing and push compile to
+ * plain loads and stores, and loops over v.d[0..v.len) can be vectorized.
+ * Only growing the storage calls into the library. The same storage is also
+ * available as the struct vec v, for use with the vec_* functions. get and
+ * pop check their index like vec_get and vec_remove do, in DS_DEBUG builds.
+ */
+#ifdef DS_DEBUG
+#include <stdio.h>
+#include <stdlib.h>
+/* same as asrt in core.h, which is not available to users of the macro */
+#define DS_VEC_ASRT(b, msg) do { \
+	if (!(b)) { \
+		fprintf(stderr, "assert error msg: %s\n", msg); \
+		abort(); \
+	} \
+} while (0)
+#else
+#define DS_VEC_ASRT(b, msg) ((void)0)
+#endif
+#define DS_VEC_DEFINE(name, type) \
+struct name { \
+	union { \
+		struct vec v; \
+		struct { \
+			type *d; \
+			int len, cap; \
+			size_t itemsize; \
+			const struct allocator *alloc; \
+		}; \
+	}; \
+}; \
+_Static_assert(offsetof(struct name, d) == offsetof(struct vec, d) \
+	&& offsetof(struct name, len) == offsetof(struct vec, len) \
+	&& offsetof(struct name, cap) == offsetof(struct vec, cap) \
+	&& offsetof(struct name, alloc) == offsetof(struct vec, alloc) \
+	&& sizeof(struct name) == sizeof(struct vec), \
+	"struct " #name " must match struct vec"); \
+static inline struct name name##_new(const struct allocator *alloc) { \
+	return (struct name){ .v = vec_new_with_alloc(sizeof(type), alloc) }; \
+} \
+static inline type *name##_get(struct name *v, int i) { \
+	DS_VEC_ASRT(i >= 0 && i < v->len, "bad vec index"); \
+	return &v->d[i]; \
+} \
+static inline bool name##_push(struct name *v, type x) { \
+	if (v->len == v->cap && !vec_grow(&v->v, 1)) return false; \
+	v->d[v->len++] = x; \
+	return true; \
+} \
+static inline type name##_pop(struct name *v) { \
+	DS_VEC_ASRT(v->len > 0, "pop from empty vec"); \
+	return v->d[--v->len]; \
+} \
+static inline bool name##_reserve(struct name *v, int cap) { \
+	return vec_reserve(&v->v, cap); \
+} \
+static inline void name##_free(struct name *v) { \
+	vec_free(&v->v); \
+}
+
 #endif
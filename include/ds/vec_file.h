@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_VEC_FILE_H
+#define DS_VEC_FILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <ds/vec.h>
+
+/*
+ * A vec stored in a memory mapped file. f->v is a regular struct vec, use it
+ * with vec_get, vec_append, etc. Its allocator grows the file with ftruncate
+ * and the mapping with mremap, so the elements are never copied, and the OS
+ * pages them in and out as needed.
+ *
+ * The file starts with a small header with the item size and the length. The
+ * length is written there by vec_file_sync and vec_file_close; reopening the
+ * file maps it again, without reading the data. The elements must not contain
+ * pointers. f->v.alloc points into f, so f must not be moved while open.
+ *
+ * vec_copy of f->v makes a copy in memory: the allocator passes everything
+ * but the mapping on to malloc. The copy shares f->v.alloc, so it has to be
+ * freed before vec_file_close.
+ */
+struct vec_file {
+	struct vec v;
+	struct allocator alloc;
+	int fd;
+	void *map;
+	size_t map_size;
+};
+
+/* Opens or creates the file. Fails if it exists with a different itemsize. */
+bool vec_file_open(struct vec_file *f, const char *path, size_t itemsize);
+/* Stores the length in the header and flushes the mapping to the file. */
+bool vec_file_sync(struct vec_file *f);
+/* Syncs, then unmaps and closes the file. */
+bool vec_file_close(struct vec_file *f);
+
+#endif
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ds/arena.h>
+#include "core.h"
+
+#define DEFAULT_CHUNK_SIZE (64 * 1024)
+#define ALIGN alignof(max_align_t)
+
+struct arena_chunk {
+	struct arena_chunk *prev;
+	size_t cap, used;
+	max_align_t d[];
+};
+
+static size_t align_up(size_t n) {
+	return (n + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+static char *chunk_data(struct arena_chunk *c) {
+	return (char *)c->d;
+}
+
+/* true if ptr (of size bytes) is the last allocation in the current chunk */
+static bool is_last(struct arena *a, void *ptr, size_t size) {
+	struct arena_chunk *c = a->chunk;
+	if (!c || (char *)ptr < chunk_data(c)
+			|| (char *)ptr >= chunk_data(c) + c->used) {
+		return false;
+	}
+	size_t off = (char *)ptr - chunk_data(c);
+	return align_up(off + size) == c->used;
+}
+
+static void *arena_alloc_cb(void *ctx, size_t size) {
+	return arena_alloc(ctx, size);
+}
+static void *arena_realloc_cb(void *ctx, void *ptr, size_t old_size,
+		size_t new_size) {
+	struct arena *a = ctx;
+	if (!ptr) return arena_alloc(a, new_size);
+
+	if (is_last(a, ptr, old_size)) {
+		size_t off = (char *)ptr - chunk_data(a->chunk);
+		if (off + new_size <= a->chunk->cap) {
+			a->chunk->used = align_up(off + new_size);
+			return ptr;
+		}
+	}
+	if (new_size <= old_size) return ptr;
+
+	void *n = arena_alloc(a, new_size);
+	if (n) memcpy(n, ptr, old_size);
+	return n;
+}
+static void arena_free_cb(void *ctx, void *ptr, size_t size) {
+	struct arena *a = ctx;
+	if (is_last(a, ptr, size)) {
+		a->chunk->used = (char *)ptr - chunk_data(a->chunk);
+	}
+}
+
+void arena_init(struct arena *a, size_t chunk_size) {
+	a->chunk = NULL;
+	a->chunk_size = chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE;
+	a->alloc = (struct allocator){
+		.alloc = arena_alloc_cb,
+		.realloc = arena_realloc_cb,
+		.free = arena_free_cb,
+		.ctx = a,
+	};
+}
+
+void arena_finish(struct arena *a) {
+	arena_rewind(a, (struct arena_mark){ .chunk = NULL, .used = 0 });
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+	struct arena_chunk *c = a->chunk;
+	size = align_up(size ? size : 1);
+	if (!c || c->cap - c->used < size) {
+		/* big allocations get a chunk of their own size */
+		size_t cap = size > a->chunk_size ? size : a->chunk_size;
+		c = malloc(sizeof(*c) + cap);
+		if (!c) return NULL;
+		c->prev = a->chunk;
+		c->cap = cap;
+		c->used = 0;
+		a->chunk = c;
+	}
+	void *p = chunk_data(c) + c->used;
+	c->used += size;
+	return p;
+}
+
+struct arena_mark arena_mark(const struct arena *a) {
+	return (struct arena_mark){
+		.chunk = a->chunk,
+		.used = a->chunk ? a->chunk->used : 0,
+	};
+}
+
+void arena_rewind(struct arena *a, struct arena_mark m) {
+	while (a->chunk != m.chunk) {
+		asrt(a->chunk, "mark from another arena");
+		struct arena_chunk *prev = a->chunk->prev;
+		free(a->chunk);
+		a->chunk = prev;
+	}
+	if (a->chunk) a->chunk->used = m.used;
+}
+
+static _Thread_local struct arena thread_arena;
+static _Thread_local bool thread_arena_init;
+
+struct arena *arena_thread(void) {
+	if (!thread_arena_init) {
+		arena_init(&thread_arena, 0);
+		thread_arena_init = true;
+	}
+	return &thread_arena;
+}
@@ -20,4 +20,24 @@ static inline void asrt(bool b, const char *msg) {
 #define container_of(ptr, type, member) \
 	(type *)((char *)(ptr) - offsetof(type, member))
 
+#include <stdlib.h>
+#include <ds/alloc.h>
+
+/* a == NULL selects malloc/realloc/free */
+static inline void *allocator_alloc(const struct allocator *a, size_t size) {
+	if (!a) return malloc(size);
+	return a->alloc(a->ctx, size);
+}
+static inline void *allocator_realloc(const struct allocator *a, void *ptr,
+		size_t old_size, size_t new_size) {
+	if (!a) return realloc(ptr, new_size);
+	return a->realloc(a->ctx, ptr, old_size, new_size);
+}
+static inline void allocator_free(const struct allocator *a, void *ptr,
+		size_t size) {
+	if (!ptr) return;
+	if (!a) free(ptr);
+	else a->free(a->ctx, ptr, size);
+}
+
 #endif
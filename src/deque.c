@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <string.h>
+
+#include <ds/deque.h>
+#include "core.h"
+
+#define DEQUE_MIN_CAP 8
+
+static int mini(int a, int b) { return a < b ? a : b; }
+
+static char *slot(struct deque *q, int i) {
+	return (char *)q->v.d
+		+ ((q->head + i) & (q->v.cap - 1)) * q->v.itemsize;
+}
+
+/* Copies l elements from n into the ring starting at logical index i. */
+static void copy_in(struct deque *q, int i, const char *n, int l) {
+	int start = (q->head + i) & (q->v.cap - 1);
+	int first = mini(l, q->v.cap - start);
+	size_t is = q->v.itemsize;
+	memcpy((char *)q->v.d + start * is, n, first * is);
+	memcpy(q->v.d, n + first * is, (l - first) * is);
+}
+
+/* Copies l elements starting at logical index i out of the ring. */
+static void copy_out(struct deque *q, int i, char *out, int l) {
+	int start = (q->head + i) & (q->v.cap - 1);
+	int first = mini(l, q->v.cap - start);
+	size_t is = q->v.itemsize;
+	memcpy(out, (char *)q->v.d + start * is, first * is);
+	memcpy(out + first * is, q->v.d, (l - first) * is);
+}
+
+struct deque deque_new(size_t itemsize, const struct allocator *alloc) {
+	return (struct deque){
+		.v = vec_new_with_alloc(itemsize, alloc),
+		.head = 0,
+	};
+}
+void deque_free(struct deque *q) {
+	vec_free(&q->v);
+	q->head = 0;
+}
+void deque_clear(struct deque *q) {
+	q->v.len = 0;
+	q->head = 0;
+}
+int deque_len(const struct deque *q) {
+	return q->v.len;
+}
+void * deque_get(struct deque *q, int i) {
+	asrt(i >= 0 && i < q->v.len, "bad deque index");
+	return slot(q, i);
+}
+bool deque_reserve(struct deque *q, int cap) {
+	if (cap <= q->v.cap) return true;
+	int old_cap = q->v.cap;
+	int new_cap = old_cap ? old_cap : DEQUE_MIN_CAP;
+	while (new_cap < cap) new_cap *= 2;
+	if (!vec_reserve(&q->v, new_cap)) return false;
+
+	/* If the elements wrapped around, move the part at the end of the old
+	 * ring to the end of the new one. */
+	if (q->head + q->v.len > old_cap) {
+		int l = old_cap - q->head;
+		size_t is = q->v.itemsize;
+		memcpy((char *)q->v.d + (new_cap - l) * is,
+			(char *)q->v.d + q->head * is, l * is);
+		q->head = new_cap - l;
+	}
+	return true;
+}
+bool deque_push_back(struct deque *q, const void *n) {
+	return deque_push_back_multiple(q, n, 1);
+}
+bool deque_push_front(struct deque *q, const void *n) {
+	if (q->v.len == q->v.cap && !deque_reserve(q, q->v.len + 1)) {
+		return false;
+	}
+	q->head = (q->head - 1) & (q->v.cap - 1);
+	++q->v.len;
+	memcpy(slot(q, 0), n, q->v.itemsize);
+	return true;
+}
+bool deque_pop_front(struct deque *q, void *out) {
+	return deque_pop_front_multiple(q, out, 1) == 1;
+}
+bool deque_pop_back(struct deque *q, void *out) {
+	if (q->v.len == 0) return false;
+	--q->v.len;
+	if (out) memcpy(out, slot(q, q->v.len), q->v.itemsize);
+	return true;
+}
+bool deque_push_back_multiple(struct deque *q, const void *n, int l) {
+	asrt(l >= 0, "bad deque length");
+	if (l == 0) return true;
+	if (!deque_reserve(q, q->v.len + l)) return false;
+	copy_in(q, q->v.len, n, l);
+	q->v.len += l;
+	return true;
+}
+int deque_pop_front_multiple(struct deque *q, void *out, int l) {
+	l = mini(l, q->v.len);
+	if (l <= 0) return 0;
+	if (out) copy_out(q, 0, out, l);
+	q->head = (q->head + l) & (q->v.cap - 1);
+	q->v.len -= l;
+	return l;
+}
+
+bool spsc_ring_init(struct spsc_ring *r, size_t itemsize, int cap,
+		const struct allocator *alloc) {
+	unsigned c = 1;
+	while (c < (unsigned)cap) c *= 2;
+	r->d = allocator_alloc(alloc, c * itemsize);
+	if (!r->d) return false;
+	r->itemsize = itemsize;
+	r->mask = c - 1;
+	r->alloc = alloc;
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->head, 0);
+	r->head_cache = 0;
+	r->tail_cache = 0;
+	return true;
+}
+void spsc_ring_finish(struct spsc_ring *r) {
+	allocator_free(r->alloc, r->d, (r->mask + 1) * r->itemsize);
+	r->d = NULL;
+}
+
+/* Copies l items between the ring at index i and buf, in two spans if the
+ * range wraps around. */
+static void ring_copy(struct spsc_ring *r, unsigned i, char *buf, int l,
+		bool in) {
+	unsigned start = i & r->mask;
+	unsigned first = mini(l, r->mask + 1 - start);
+	size_t is = r->itemsize;
+	if (in) {
+		memcpy(r->d + start * is, buf, first * is);
+		memcpy(r->d, buf + first * is, (l - first) * is);
+	} else {
+		memcpy(buf, r->d + start * is, first * is);
+		memcpy(buf + first * is, r->d, (l - first) * is);
+	}
+}
+
+/*
+ * The indices run freely and are only masked when used, so head == tail means
+ * empty, and tail - head == cap means full. The producer publishes items with
+ * a release store of tail, which the consumer reads with acquire (and the
+ * other way around for freeing slots with head).
+ */
+int spsc_ring_push_multiple(struct spsc_ring *r, const void *n, int l) {
+	unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	unsigned cap = r->mask + 1;
+	if (tail - r->head_cache + l > cap) {
+		r->head_cache = atomic_load_explicit(&r->head,
+			memory_order_acquire);
+	}
+	l = mini(l, cap - (tail - r->head_cache));
+	if (l <= 0) return 0;
+	ring_copy(r, tail, (char *)n, l, true);
+	atomic_store_explicit(&r->tail, tail + l, memory_order_release);
+	return l;
+}
+bool spsc_ring_push(struct spsc_ring *r, const void *n) {
+	return spsc_ring_push_multiple(r, n, 1) == 1;
+}
+int spsc_ring_pop_multiple(struct spsc_ring *r, void *out, int l) {
+	unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (r->tail_cache - head < (unsigned)l) {
+		r->tail_cache = atomic_load_explicit(&r->tail,
+			memory_order_acquire);
+	}
+	l = mini(l, r->tail_cache - head);
+	if (l <= 0) return 0;
+	ring_copy(r, head, out, l, false);
+	atomic_store_explicit(&r->head, head + l, memory_order_release);
+	return l;
+}
+bool spsc_ring_pop(struct spsc_ring *r, void *out) {
+	return spsc_ring_pop_multiple(r, out, 1) == 1;
+}
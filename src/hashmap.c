@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "core.h"
+
 static const uint32_t INITIAL_SIZE = 1 << 8;
 
 /*
@@ -56,13 +58,29 @@ struct element {
 	uint8_t data[];
 };
 
-void hashmap_init(struct hashmap *m, size_t itemsize) {
-	m->data = calloc(INITIAL_SIZE, sizeof(struct element) + itemsize);
-	if (!m->data) return;
+static void *table_alloc(struct hashmap *m, uint32_t table_size) {
+	size_t size = table_size * (sizeof(struct element) + m->itemsize);
+	void *data = allocator_alloc(m->alloc, size);
+	if (data) memset(data, 0, size);
+	return data;
+}
+static void table_free(struct hashmap *m, void *data, uint32_t table_size) {
+	allocator_free(m->alloc, data,
+		table_size * (sizeof(struct element) + m->itemsize));
+}
 
-	m->table_size = INITIAL_SIZE;
+void hashmap_init(struct hashmap *m, size_t itemsize) {
+	hashmap_init_with_alloc(m, itemsize, NULL);
+}
+void hashmap_init_with_alloc(struct hashmap *m, size_t itemsize,
+		const struct allocator *alloc) {
 	m->size = 0;
 	m->itemsize = itemsize;
+	m->alloc = alloc;
+
+	/* On failure the table stays empty, the next put retries. */
+	m->data = table_alloc(m, INITIAL_SIZE);
+	m->table_size = m->data ? INITIAL_SIZE : 0;
 }
 
 static bool hashmap_hash(struct hashmap *m, struct hashmap_buffer key,
@@ -98,12 +116,11 @@ static int hashmap_put_internal(struct hashmap *m, struct hashmap_buffer key,
  */
 static int hashmap_rehash(struct hashmap *m) {
 	// table_size must remain a power of 2
-	int new_size = m->table_size << 1;
+	int new_size = m->table_size ? m->table_size << 1 : INITIAL_SIZE;
 	void *curr = m->data;
 
 	/* Setup the new elements */
-	struct element* temp =
-		calloc(new_size, sizeof(struct element) + m->itemsize);
+	struct element* temp = table_alloc(m, new_size);
 	if (!temp) return MAP_OMEM;
 
 	/* Update the array */
@@ -126,7 +143,7 @@ static int hashmap_rehash(struct hashmap *m) {
 		if (status != MAP_OK) return status;
 	}
 
-	free(curr);
+	table_free(m, curr, old_size);
 
 	return MAP_OK;
 }
@@ -229,7 +246,7 @@ int hashmap_del(struct hashmap *m, struct hashmap_buffer key) {
 }
 
 void hashmap_finish(struct hashmap *m) {
-	free(m->data);
+	table_free(m, m->data, m->table_size);
 }
 
 int hashmap_length(const struct hashmap *m) {
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <stdlib.h>
+#include <string.h>
+
+#include <ds/intern.h>
+#include "core.h"
+
+#define CHUNK_SIZE (16 * 1024)
+
+void intern_init(struct intern *in) {
+	hashmap_init(&in->map, sizeof(uint32_t));
+	in->atoms = vec_new_empty(sizeof(struct str_slice));
+	in->chunks = vec_new_empty(sizeof(char *));
+	in->cur = NULL;
+	in->cur_left = 0;
+}
+
+void intern_finish(struct intern *in) {
+	for (int i = 0; i < in->chunks.len; ++i) {
+		free(*(char **)vec_get(&in->chunks, i));
+	}
+	vec_free(&in->chunks);
+	vec_free(&in->atoms);
+	hashmap_finish(&in->map);
+}
+
+/* Copies s into the arena, with a '\0' after it. */
+static char *arena_copy(struct intern *in, struct str_slice s) {
+	if (s.len + 1 > in->cur_left) {
+		/* long strings get their own chunk, keep the current one */
+		int size = s.len + 1 > CHUNK_SIZE ? s.len + 1 : CHUNK_SIZE;
+		char *chunk = malloc(size);
+		if (!chunk) return NULL;
+		if (vec_append(&in->chunks, &chunk) < 0) {
+			free(chunk);
+			return NULL;
+		}
+		if (size == CHUNK_SIZE) {
+			in->cur = chunk;
+			in->cur_left = size;
+		} else {
+			memcpy(chunk, s.d, s.len);
+			chunk[s.len] = '\0';
+			return chunk;
+		}
+	}
+	char *d = in->cur;
+	memcpy(d, s.d, s.len);
+	d[s.len] = '\0';
+	in->cur += s.len + 1;
+	in->cur_left -= s.len + 1;
+	return d;
+}
+
+static struct hashmap_buffer key(struct str_slice s) {
+	return (struct hashmap_buffer){
+		.d = (const uint8_t *)s.d, .len = s.len };
+}
+
+int intern_find(struct intern *in, struct str_slice s) {
+	uint32_t *atom;
+	if (hashmap_get(&in->map, key(s), (void **)&atom) != MAP_OK) {
+		return -1;
+	}
+	return *atom;
+}
+
+int intern_slice(struct intern *in, struct str_slice s) {
+	int atom = intern_find(in, s);
+	if (atom >= 0) return atom;
+
+	char *d = arena_copy(in, s);
+	if (!d) return -1;
+	struct str_slice canon = { .d = d, .len = s.len };
+
+	/* on failure, the copy stays unused in the arena */
+	atom = vec_append(&in->atoms, &canon);
+	if (atom < 0) return -1;
+	uint32_t value = atom;
+	if (hashmap_put(&in->map, key(canon), &value) != MAP_OK) {
+		--in->atoms.len;
+		return -1;
+	}
+	return atom;
+}
+
+int intern_cstr(struct intern *in, const char *cstr) {
+	return intern_slice(in,
+		(struct str_slice){ .d = cstr, .len = strlen(cstr) });
+}
+
+struct str_slice intern_get(const struct intern *in, int atom) {
+	return *(const struct str_slice *)vec_get_c(&in->atoms, atom);
+}
+
+int intern_count(const struct intern *in) {
+	return in->atoms.len;
+}
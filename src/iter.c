@@ -1,39 +1,397 @@
 // SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <ds/iter.h>
+#include "core.h"
+#include "iter_internal.h"
 
-bool str_gen_next(struct str_gen *g, struct str_slice *res) {
-	switch (g->kind) {
-	case STR_GEN_KIND_SPLIT: ;
-		/* this is hacky AF, please refactor this sometime! */
-		int *i = &g->split.i;
-		int from = *i;
-		if (from == g->split.s.len) {
-			++(*i);
-			if (from == 0 || g->split.s.d[from - 1] == g->split.c) {
-				*res = (struct str_slice){
-					.d = g->split.s.d + from,
-					.len = 0
-				};
-				return true;
-			}
+/*
+ * Split state: split.i is the start of the next piece, and it is past the end
+ * of the string (len + 1) once the last piece was returned. A string with n
+ * delimiters always gives n + 1 pieces.
+ */
+static bool split_next(struct str_gen_split *sp, struct str_slice *res) {
+	const char *d = sp->s.d;
+	int len = sp->s.len, i = sp->i;
+	if (i > len) return false;
+
+	const char *p = i < len ? memchr(d + i, sp->c, len - i) : NULL;
+	int end = p ? p - d : len;
+	*res = (struct str_slice){ .d = d + i, .len = end - i };
+	sp->i = end + 1;
+	return true;
+}
+
+int str_gen_split_bulk(struct str_gen *g, struct str_slice *out, int n) {
+	asrt(g->kind == STR_GEN_KIND_SPLIT, "not a split generator");
+	const char *d = g->split.s.d;
+	int len = g->split.s.len, i = g->split.i;
+	int k = 0;
+	if (i > len) return 0;
+
+	/* Scan in blocks of 64 bytes, emitting a piece for each set bit. If out
+	 * fills up mid-block, the next call rescans from i. */
+	for (int pos = i; k < n; ) {
+		if (pos >= len) {
+			out[k++] = (struct str_slice){
+				.d = d + i, .len = len - i
+			};
+			i = len + 1;
+			break;
 		}
-		if (from >= g->split.s.len) return false;
-		while (*i < g->split.s.len) {
-			++(*i);
-			if (g->split.s.d[*i - 1] == g->split.c) {
-				*res = (struct str_slice){
-					.d = g->split.s.d + from,
-					.len = *i - from - 1
-				};
-				return true;
+		int l = len - pos < 64 ? len - pos : 64;
+		uint64_t m = str_delim_mask(d + pos, l, g->split.c);
+		while (m && k < n) {
+			int e = pos + __builtin_ctzll(m);
+			m &= m - 1;
+			out[k++] = (struct str_slice){
+				.d = d + i, .len = e - i
+			};
+			i = e + 1;
+		}
+		pos += l;
+	}
+	g->split.i = i;
+	return k;
+}
+
+/* index of the first of a, b or c in d[i, len), or len */
+static int find_any3(const char *d, int i, int len, char a, char b, char c) {
+#ifdef __SSE2__
+	__m128i aa = _mm_set1_epi8(a), bb = _mm_set1_epi8(b),
+		cc = _mm_set1_epi8(c);
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(d + i));
+		__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(x, aa),
+			_mm_or_si128(_mm_cmpeq_epi8(x, bb),
+			_mm_cmpeq_epi8(x, cc)));
+		unsigned m = _mm_movemask_epi8(eq);
+		if (m) return i + __builtin_ctz(m);
+	}
+#endif
+	for (; i < len; ++i) {
+		if (d[i] == a || d[i] == b || d[i] == c) break;
+	}
+	return i;
+}
+
+static bool csv_next(struct str_gen *g, struct str_slice *res) {
+	const char *d = g->csv.s.d;
+	int len = g->csv.s.len, i = g->csv.i;
+	char sep = g->csv.sep;
+	if (i >= len && !g->csv.pending) return false;
+
+	g->csv.escaped = false;
+	int end;
+	if (i < len && d[i] == '"') {
+		/* quoted field, "" is an escaped quote */
+		int j = i + 1;
+		for (;;) {
+			const char *q = j < len
+				? memchr(d + j, '"', len - j) : NULL;
+			if (!q) {
+				end = j = len;
+				break;
 			}
+			j = q - d;
+			if (j + 1 < len && d[j + 1] == '"') {
+				g->csv.escaped = true;
+				j += 2;
+				continue;
+			}
+			end = j++;
+			break;
 		}
+		*res = (struct str_slice){ .d = d + i + 1, .len = end - i - 1 };
+		i = find_any3(d, j, len, sep, '\n', '\r');
+	} else {
+		i = find_any3(d, i, len, sep, '\n', '\r');
 		*res = (struct str_slice){
-			.d = g->split.s.d + from,
-			.len = *i - from
+			.d = d + g->csv.i, .len = i - g->csv.i
 		};
-		return true;
+	}
+
+	/* i is at the terminator of the field: sep, a line break, or the end */
+	g->csv.pending = i < len && d[i] == sep;
+	g->csv.end_of_record = !g->csv.pending;
+	if (i < len) {
+		if (d[i] == '\r' && i + 1 < len && d[i + 1] == '\n') ++i;
+		++i;
+	}
+	g->csv.i = i;
+	return true;
+}
+
+struct str_gen str_gen_csv(struct str_slice s, char sep) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_CSV,
+		.csv = { .s = s, .sep = sep, .i = 0 },
+	};
+}
+bool str_gen_csv_end_of_record(const struct str_gen *g) {
+	asrt(g->kind == STR_GEN_KIND_CSV, "not a csv generator");
+	return g->csv.end_of_record;
+}
+bool str_gen_csv_escaped(const struct str_gen *g) {
+	asrt(g->kind == STR_GEN_KIND_CSV, "not a csv generator");
+	return g->csv.escaped;
+}
+int str_csv_unescape(struct str_slice field, char *out) {
+	int n = 0;
+	for (int i = 0; i < field.len; ++i) {
+		out[n++] = field.d[i];
+		if (field.d[i] == '"' && i + 1 < field.len
+				&& field.d[i + 1] == '"') {
+			++i;
+		}
+	}
+	return n;
+}
+
+#define SPLIT_FD_CHUNK (1024 * 1024)
+
+static bool split_fd_next(struct str_gen *g, struct str_slice *res) {
+	struct str_gen_fd *f = &g->split_fd;
+	while (!f->done) {
+		int l = f->end - f->scan;
+		const char *p = l > 0
+			? memchr(f->buf + f->scan, f->c, l) : NULL;
+		if (p) {
+			*res = (struct str_slice){
+				.d = f->buf + f->start,
+				.len = p - (f->buf + f->start)
+			};
+			f->start = f->scan = p - f->buf + 1;
+			return true;
+		}
+		f->scan = f->end;
+		if (f->eof) {
+			*res = (struct str_slice){
+				.d = f->buf + f->start,
+				.len = f->end - f->start
+			};
+			f->done = true;
+			return true;
+		}
+
+		/* Move the partial piece to the front, and read more after it.
+		 * A piece longer than the buffer grows it. */
+		if (f->start > 0) {
+			memmove(f->buf, f->buf + f->start, f->end - f->start);
+			f->end -= f->start;
+			f->scan = f->end;
+			f->start = 0;
+		}
+		if (f->end == f->cap) {
+			char *buf = realloc(f->buf, 2 * f->cap);
+			if (!buf) {
+				f->done = f->error = true;
+				break;
+			}
+			f->buf = buf;
+			f->cap *= 2;
+		}
+		ssize_t n = read(f->fd, f->buf + f->end, f->cap - f->end);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			f->done = f->error = true;
+		} else if (n == 0) {
+			f->eof = true;
+		} else {
+			f->end += n;
+		}
+	}
+	return false;
+}
+
+bool str_gen_split_fd(struct str_gen *g, int fd, char c, int chunk_size) {
+	if (chunk_size <= 0) chunk_size = SPLIT_FD_CHUNK;
+	*g = (struct str_gen){
+		.kind = STR_GEN_KIND_SPLIT_FD,
+		.split_fd = { .fd = fd, .c = c, .cap = chunk_size },
+	};
+	g->split_fd.buf = malloc(chunk_size);
+	return g->split_fd.buf != NULL;
+}
+
+static bool split_mmap_next(struct str_gen *g, struct str_slice *res) {
+	struct str_gen_mmap *m = &g->split_mmap;
+	if (m->i > m->len) return false;
+
+	const char *p = m->i < m->len
+		? memchr(m->d + m->i, m->c, m->len - m->i) : NULL;
+	size_t end = p ? (size_t)(p - m->d) : m->len;
+	asrt(end - m->i <= INT32_MAX, "piece too long");
+	*res = (struct str_slice){ .d = m->d + m->i, .len = end - m->i };
+	m->i = end + 1;
+	return true;
+}
+
+struct str_gen str_gen_split_mem(const char *d, size_t len, char c) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_SPLIT_MEM,
+		.split_mmap = { .d = d, .len = len, .i = 0, .c = c },
+	};
+}
+
+bool str_gen_split_mmap(struct str_gen *g, const char *path, char c) {
+	*g = (struct str_gen){
+		.kind = STR_GEN_KIND_SPLIT_MMAP,
+		.split_mmap = { .d = NULL, .c = c },
+	};
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	g->split_mmap.len = st.st_size;
+	if (st.st_size > 0) {
+		void *d = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (d == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		posix_madvise(d, st.st_size, POSIX_MADV_SEQUENTIAL);
+		g->split_mmap.d = d;
+	}
+	close(fd);
+	return true;
+}
+
+void str_gen_finish(struct str_gen *g) {
+	switch (g->kind) {
+	case STR_GEN_KIND_SPLIT_FD:
+		free(g->split_fd.buf);
+		g->split_fd.buf = NULL;
+		break;
+	case STR_GEN_KIND_SPLIT_MMAP:
+		if (g->split_mmap.d) {
+			munmap((void *)g->split_mmap.d, g->split_mmap.len);
+			g->split_mmap.d = NULL;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v'
+		|| c == '\f';
+}
+
+static bool trim_next(struct str_gen *g, struct str_slice *res) {
+	if (!str_gen_next(g->pipe.src, res)) return false;
+	while (res->len > 0 && is_space(res->d[0])) {
+		++res->d;
+		--res->len;
+	}
+	while (res->len > 0 && is_space(res->d[res->len - 1])) --res->len;
+	return true;
+}
+
+static bool nonempty_next(struct str_gen *g, struct str_slice *res) {
+	while (str_gen_next(g->pipe.src, res)) {
+		if (res->len > 0) return true;
+	}
+	return false;
+}
+
+/* pipe.n counts down the pieces still to take, or to skip */
+static bool take_next(struct str_gen *g, struct str_slice *res) {
+	if (g->pipe.n <= 0) return false;
+	--g->pipe.n;
+	return str_gen_next(g->pipe.src, res);
+}
+
+static bool skip_next(struct str_gen *g, struct str_slice *res) {
+	for (; g->pipe.n > 0; --g->pipe.n) {
+		if (!str_gen_next(g->pipe.src, res)) return false;
+	}
+	return str_gen_next(g->pipe.src, res);
+}
+
+static bool split_each_next(struct str_gen *g, struct str_slice *res) {
+	struct str_gen_split *cur = &g->split_each.cur;
+	while (!split_next(cur, res)) {
+		if (!str_gen_next(g->split_each.src, &cur->s)) return false;
+		cur->i = 0;
+	}
+	return true;
+}
+
+struct str_gen str_gen_trim(struct str_gen *src) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_TRIM,
+		.pipe = { .src = src },
+	};
+}
+struct str_gen str_gen_nonempty(struct str_gen *src) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_NONEMPTY,
+		.pipe = { .src = src },
+	};
+}
+struct str_gen str_gen_take(struct str_gen *src, int n) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_TAKE,
+		.pipe = { .src = src, .n = n },
+	};
+}
+struct str_gen str_gen_skip(struct str_gen *src, int n) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_SKIP,
+		.pipe = { .src = src, .n = n },
+	};
+}
+struct str_gen str_gen_split_each(struct str_gen *src, char c) {
+	/* cur starts out exhausted, so the first call pulls from src */
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_SPLIT_EACH,
+		.split_each = { .src = src, .cur = { .c = c, .i = 1 } },
+	};
+}
+
+bool str_gen_next(struct str_gen *g, struct str_slice *res) {
+	switch (g->kind) {
+	case STR_GEN_KIND_SPLIT:
+		return split_next(&g->split, res);
+	case STR_GEN_KIND_CSV:
+		return csv_next(g, res);
+	case STR_GEN_KIND_SPLIT_FD:
+		return split_fd_next(g, res);
+	case STR_GEN_KIND_SPLIT_MMAP:
+	case STR_GEN_KIND_SPLIT_MEM:
+		return split_mmap_next(g, res);
+	case STR_GEN_KIND_TRIM:
+		return trim_next(g, res);
+	case STR_GEN_KIND_NONEMPTY:
+		return nonempty_next(g, res);
+	case STR_GEN_KIND_TAKE:
+		return take_next(g, res);
+	case STR_GEN_KIND_SKIP:
+		return skip_next(g, res);
+	case STR_GEN_KIND_SPLIT_EACH:
+		return split_each_next(g, res);
+	case STR_GEN_KIND_FIND:
+		return str_gen_find_next(g, res);
+	case STR_GEN_KIND_FIND_ANY:
+		return str_gen_find_any_next(g, res);
+	case STR_GEN_KIND_CODEPOINTS:
+		return str_gen_codepoints_next(g, res);
 	}
 	return false; // unreachable
 }
@@ -45,7 +403,7 @@ struct str_gen str_gen_split(struct str_slice s, char c) {
 }
 
 struct str_slice str_as_slice(const struct str *str) {
-	return (struct str_slice){ .d = str->v.d, .len = str->v.len };
+	return (struct str_slice){ .d = str_cstr(str), .len = str_len(str) };
 }
 struct str str_new_from_slice(struct str_slice s) {
 	struct str str = str_empty;
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#ifndef DS_ITER_INTERNAL_H
+#define DS_ITER_INTERNAL_H
+#include <stdbool.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <ds/iter.h>
+
+/* Shared between the source files of the iter library, not exported. */
+#ifdef __GNUC__
+#define DS_ITER_HIDDEN __attribute__((visibility("hidden")))
+#else
+#define DS_ITER_HIDDEN
+#endif
+
+/* bit j is set iff d[j] == c, for j < l <= 64 */
+static inline uint64_t str_delim_mask(const char *d, int l, char c) {
+	uint64_t m = 0;
+#ifdef __SSE2__
+	if (l == 64) {
+		__m128i cc = _mm_set1_epi8(c);
+		for (int j = 0; j < 4; ++j) {
+			__m128i x = _mm_loadu_si128(
+				(const __m128i *)(d + 16 * j));
+			uint64_t b = (unsigned)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(x, cc));
+			m |= b << (16 * j);
+		}
+		return m;
+	}
+#endif
+	for (int j = 0; j < l; ++j) m |= (uint64_t)(d[j] == c) << j;
+	return m;
+}
+
+/* in search.c */
+DS_ITER_HIDDEN bool str_gen_find_next(struct str_gen *g,
+	struct str_slice *res);
+DS_ITER_HIDDEN bool str_gen_find_any_next(struct str_gen *g,
+	struct str_slice *res);
+/* in utf8.c */
+DS_ITER_HIDDEN bool str_gen_codepoints_next(struct str_gen *g,
+	struct str_slice *res);
+
+#endif
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ds/iter.h>
+#include "core.h"
+#include "iter_internal.h"
+
+/* below this, no threads are started */
+#define SPLIT_PARALLEL_MIN_LEN (1 << 20)
+#define SPLIT_PARALLEL_MAX_THREADS 64
+
+struct split_job {
+	const char *d;
+	size_t len; /* the chunk, without its final delimiter */
+	char c;
+	int chunk;
+	void (*run)(struct split_job *j);
+	/* str_split_parallel_each */
+	void (*fn)(void *env, int chunk, struct str_gen *g);
+	void *env;
+	/* str_split_parallel: the number of pieces, and where they go */
+	size_t pieces;
+	struct str_slice *out;
+};
+
+static void *split_job_run(void *arg) {
+	struct split_job *j = arg;
+	j->run(j);
+	return NULL;
+}
+
+/* Runs the jobs on threads (the first one on the calling thread). */
+static void run_jobs(struct split_job *jobs, int n) {
+	pthread_t th[SPLIT_PARALLEL_MAX_THREADS];
+	bool started[SPLIT_PARALLEL_MAX_THREADS];
+	for (int i = 1; i < n; ++i) {
+		started[i] = pthread_create(&th[i], NULL, split_job_run,
+			&jobs[i]) == 0;
+	}
+	split_job_run(&jobs[0]);
+	for (int i = 1; i < n; ++i) {
+		if (started[i]) {
+			pthread_join(th[i], NULL);
+		} else {
+			split_job_run(&jobs[i]);
+		}
+	}
+}
+
+/*
+ * Cuts d[0, len) into at most k chunks, each one but the last ending right
+ * after a delimiter. The last one may be empty, if the input ends with a
+ * delimiter: it holds the trailing empty piece. Splitting the chunks (without
+ * their delimiter) one after the other thus gives the same pieces as
+ * splitting the whole input.
+ */
+static int cut_chunks(const char *d, size_t len, char c, int k,
+		size_t *bound) {
+	int n = 0;
+	bound[0] = 0;
+	for (int i = 1; i < k; ++i) {
+		/* len * i / k, without overflowing */
+		size_t p = len / k * i + len % k * i / k;
+		if (p < bound[n]) p = bound[n];
+		const char *q = p < len ? memchr(d + p, c, len - p) : NULL;
+		if (!q) break;
+		bound[++n] = q - d + 1;
+	}
+	bound[++n] = len;
+	return n;
+}
+
+static int make_jobs(const char *d, size_t len, char c, int nthreads,
+		struct split_job *jobs) {
+	int k = nthreads < SPLIT_PARALLEL_MAX_THREADS
+		? nthreads : SPLIT_PARALLEL_MAX_THREADS;
+	if (k < 1 || len < SPLIT_PARALLEL_MIN_LEN) k = 1;
+
+	size_t bound[SPLIT_PARALLEL_MAX_THREADS + 1];
+	int n = cut_chunks(d, len, c, k, bound);
+	for (int i = 0; i < n; ++i) {
+		size_t end = i + 1 < n ? bound[i + 1] - 1 : bound[i + 1];
+		jobs[i] = (struct split_job){
+			.d = d + bound[i], .len = end - bound[i],
+			.c = c, .chunk = i,
+		};
+	}
+	return n;
+}
+
+static void each_run(struct split_job *j) {
+	struct str_gen g = str_gen_split_mem(j->d, j->len, j->c);
+	j->fn(j->env, j->chunk, &g);
+}
+
+int str_split_parallel_each(const char *d, size_t len, char c, int nthreads,
+		void (*fn)(void *env, int chunk, struct str_gen *g),
+		void *env) {
+	struct split_job jobs[SPLIT_PARALLEL_MAX_THREADS];
+	int n = make_jobs(d, len, c, nthreads, jobs);
+	for (int i = 0; i < n; ++i) {
+		jobs[i].run = each_run;
+		jobs[i].fn = fn;
+		jobs[i].env = env;
+	}
+	run_jobs(jobs, n);
+	return n;
+}
+
+/* A chunk with n delimiters has n + 1 pieces. */
+static void count_run(struct split_job *j) {
+	size_t n = 1;
+	for (size_t i = 0; i < j->len; i += 64) {
+		int l = j->len - i < 64 ? j->len - i : 64;
+		n += __builtin_popcountll(str_delim_mask(j->d + i, l, j->c));
+	}
+	j->pieces = n;
+}
+
+static void write_run(struct split_job *j) {
+	struct str_slice *o = j->out;
+	size_t start = 0;
+	for (size_t i = 0; i < j->len; i += 64) {
+		int l = j->len - i < 64 ? j->len - i : 64;
+		for (uint64_t m = str_delim_mask(j->d + i, l, j->c); m;
+				m &= m - 1) {
+			size_t end = i + __builtin_ctzll(m);
+			asrt(end - start <= INT32_MAX, "piece too long");
+			*o++ = (struct str_slice){
+				.d = j->d + start, .len = end - start };
+			start = end + 1;
+		}
+	}
+	asrt(j->len - start <= INT32_MAX, "piece too long");
+	*o = (struct str_slice){ .d = j->d + start, .len = j->len - start };
+}
+
+bool str_split_parallel(const char *d, size_t len, char c, int nthreads,
+		struct vec *out) {
+	asrt(out->itemsize == sizeof(struct str_slice), "bad out itemsize");
+	struct split_job jobs[SPLIT_PARALLEL_MAX_THREADS];
+	int n = make_jobs(d, len, c, nthreads, jobs);
+	for (int i = 0; i < n; ++i) jobs[i].run = count_run;
+	run_jobs(jobs, n);
+
+	/* only the calling thread allocates */
+	size_t total = 0;
+	for (int i = 0; i < n; ++i) total += jobs[i].pieces;
+	if (total > (size_t)(INT_MAX - out->len)) return false;
+	if (!vec_grow(out, total)) return false;
+
+	struct str_slice *o = (struct str_slice *)out->d + out->len;
+	for (int i = 0; i < n; ++i) {
+		jobs[i].run = write_run;
+		jobs[i].out = o;
+		o += jobs[i].pieces;
+	}
+	run_jobs(jobs, n);
+	out->len += total;
+	return true;
+}
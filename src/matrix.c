@@ -2,6 +2,12 @@
 #include <math.h>
 #include <string.h>
 #include <ds/matrix.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX_DISPATCH
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 /* Ideas taken from the wlroots matrix utilities
  * (wlroots/types/wlr_matrix.c). */
@@ -43,47 +49,121 @@ void mat3_t(float m[static 9])
 	memcpy(m, t, sizeof(t));
 }
 
+/*
+ * The transforms below are applied from the left (m <- X * m), where X only
+ * differs from the identity in its upper two rows. So only the first two rows
+ * of m change, in closed form, instead of a full 3x3 multiplication.
+ */
+
 void mat3_tran(float m[static 9], const float t[static 2])
 {
-	const float r[9] = {
-		1, 0, t[0],
-		0, 1, t[1],
-		0, 0, 1,
-	};
-	mat3_mul_l(m, r);
+	for (int j = 0; j < 3; ++j) {
+		m[j] += t[0] * m[6 + j];
+		m[3 + j] += t[1] * m[6 + j];
+	}
+}
+
+/* Both below only touch the first two rows, shared with mat2x3. */
+static void scale_rows(float *m, const float s[static 2])
+{
+	for (int j = 0; j < 3; ++j) {
+		m[j] *= s[0];
+		m[3 + j] *= s[1];
+	}
+}
+
+static void rot_rows(float *m, float a)
+{
+	/* computed once, compilers merge the pair into one sincos call */
+	const float c = cos(a), s = sin(a);
+	for (int j = 0; j < 3; ++j) {
+		const float r0 = m[j], r1 = m[3 + j];
+		m[j] = c * r0 - s * r1;
+		m[3 + j] = s * r0 + c * r1;
+	}
 }
 
 void mat3_scale(float m[static 9], const float s[static 2])
 {
-	const float r[9] = {
-		s[0], 0, 0,
-		0, s[1], 0,
-		0, 0, 1,
-	};
-	mat3_mul_l(m, r);
+	scale_rows(m, s);
 }
 
 void mat3_rot(float m[static 9], float a)
 {
-	const float r[9] = {
-		cos(a), -sin(a), 0,
-		sin(a), cos(a), 0,
-		0, 0, 1,
-	};
-	mat3_mul_l(m, r);
+	rot_rows(m, a);
 }
 
 void mat3_proj(float m[static 9], const int size[static 2])
 {
-	const float s[2] = { 2.0f / size[0], 2.0f / size[1] };
-	mat3_scale(m, s);
+	/* scale by 2 / size, translate by (-1, -1), then flip y */
+	const float sx = 2.0f / size[0], sy = 2.0f / size[1];
+	for (int j = 0; j < 3; ++j) {
+		m[j] = sx * m[j] - m[6 + j];
+		m[3 + j] = -sy * m[3 + j] + m[6 + j];
+	}
+}
 
-	const float t[2] = { -1, -1 };
-	mat3_tran(m, t);
+void mat2x3_ident(float m[static 6])
+{
+	static const float ident[6] = {
+		1, 0, 0,
+		0, 1, 0,
+	};
+	memcpy(m, ident, sizeof(ident));
+}
+
+void mat2x3_mul_l(float A[static 6], const float B[static 6])
+{
+	const float m[6] = {
+		B[0] * A[0] + B[1] * A[3],
+		B[0] * A[1] + B[1] * A[4],
+		B[0] * A[2] + B[1] * A[5] + B[2],
+		B[3] * A[0] + B[4] * A[3],
+		B[3] * A[1] + B[4] * A[4],
+		B[3] * A[2] + B[4] * A[5] + B[5],
+	};
+	memcpy(A, m, sizeof(m));
+}
+
+void mat2x3_tran(float m[static 6], const float t[static 2])
+{
+	m[2] += t[0];
+	m[5] += t[1];
+}
+
+void mat2x3_scale(float m[static 6], const float s[static 2])
+{
+	scale_rows(m, s);
+}
+
+void mat2x3_rot(float m[static 6], float a)
+{
+	rot_rows(m, a);
+}
 
-	const float k[2] = { 1, -1 };
-	mat3_scale(m, k);
+bool mat2x3_invert(float out[static 6], const float m[static 6])
+{
+	const float det = m[0] * m[4] - m[1] * m[3];
+	if (det == 0) return false;
+	const float id = 1.0f / det;
+	const float a = m[4] * id, b = -m[1] * id;
+	const float c = -m[3] * id, d = m[0] * id;
+	const float r[6] = {
+		a, b, -(a * m[2] + b * m[5]),
+		c, d, -(c * m[2] + d * m[5]),
+	};
+	memcpy(out, r, sizeof(r));
+	return true;
+}
 
+void mat2x3_to_mat3(float out[static 9], const float m[static 6])
+{
+	const float r[9] = {
+		m[0], m[1], m[2],
+		m[3], m[4], m[5],
+		0, 0, 1,
+	};
+	memcpy(out, r, sizeof(r));
 }
 
 bool aabb_contains(const float aabb[static 4], const float p[static 2])
@@ -101,3 +181,203 @@ void aabb_intersect(float out[static 4], const float a[static 4],
 	out[2] = fminf(a[0] + a[2], b[0] + b[2]) - out[0];
 	out[3] = fminf(a[1] + a[3], b[1] + b[3]) - out[1];
 }
+
+/*
+ * Point transformation. p' = M (x, y, 1)^T, divided by its third component
+ * for the projective variants. The vector versions process the bulk of the
+ * points, and the scalar ones the remainder.
+ */
+
+static void apply_scalar(const float m[static 9], float *out_x, float *out_y,
+		const float *x, const float *y, int stride, int n, bool proj)
+{
+	for (int i = 0; i < n; ++i) {
+		float px = x[i * stride], py = y[i * stride];
+		float rx = m[0] * px + m[1] * py + m[2];
+		float ry = m[3] * px + m[4] * py + m[5];
+		if (proj) {
+			float w = m[6] * px + m[7] * py + m[8];
+			rx /= w;
+			ry /= w;
+		}
+		out_x[i * stride] = rx;
+		out_y[i * stride] = ry;
+	}
+}
+
+#ifdef HAVE_AVX_DISPATCH
+/*
+ * AoS: a vector holds interleaved points x0 y0 x1 y1 ... Duplicating the x
+ * and the y lanes gives x0 x0 x1 x1 ... and y0 y0 y1 y1 ..., which multiplied
+ * by m0 m3 m0 m3 ... and m1 m4 m1 m4 ... (plus m2 m5 m2 m5 ...) gives the
+ * transformed points in the same layout.
+ */
+__attribute__((target("avx,fma")))
+static int apply_aos_avx(const float m[static 9], float *out,
+		const float *in, int n, bool proj)
+{
+	const __m256 a = _mm256_setr_ps(m[0], m[3], m[0], m[3],
+		m[0], m[3], m[0], m[3]);
+	const __m256 b = _mm256_setr_ps(m[1], m[4], m[1], m[4],
+		m[1], m[4], m[1], m[4]);
+	const __m256 c = _mm256_setr_ps(m[2], m[5], m[2], m[5],
+		m[2], m[5], m[2], m[5]);
+	const __m256 wa = _mm256_set1_ps(m[6]), wb = _mm256_set1_ps(m[7]),
+		wc = _mm256_set1_ps(m[8]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256 p = _mm256_loadu_ps(in + 2 * i);
+		__m256 xs = _mm256_moveldup_ps(p), ys = _mm256_movehdup_ps(p);
+		__m256 r = _mm256_fmadd_ps(xs, a, _mm256_fmadd_ps(ys, b, c));
+		if (proj) {
+			r = _mm256_div_ps(r, _mm256_fmadd_ps(xs, wa,
+				_mm256_fmadd_ps(ys, wb, wc)));
+		}
+		_mm256_storeu_ps(out + 2 * i, r);
+	}
+	return i;
+}
+
+__attribute__((target("avx,fma")))
+static int apply_soa_avx(const float m[static 9], float *out_x, float *out_y,
+		const float *x, const float *y, int n, bool proj)
+{
+	const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]),
+		m2 = _mm256_set1_ps(m[2]), m3 = _mm256_set1_ps(m[3]),
+		m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]),
+		m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]),
+		m8 = _mm256_set1_ps(m[8]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+		__m256 rx = _mm256_fmadd_ps(px, m0,
+			_mm256_fmadd_ps(py, m1, m2));
+		__m256 ry = _mm256_fmadd_ps(px, m3,
+			_mm256_fmadd_ps(py, m4, m5));
+		if (proj) {
+			__m256 w = _mm256_fmadd_ps(px, m6,
+				_mm256_fmadd_ps(py, m7, m8));
+			rx = _mm256_div_ps(rx, w);
+			ry = _mm256_div_ps(ry, w);
+		}
+		_mm256_storeu_ps(out_x + i, rx);
+		_mm256_storeu_ps(out_y + i, ry);
+	}
+	return i;
+}
+
+static bool have_avx_fma(void)
+{
+	return __builtin_cpu_supports("avx") && __builtin_cpu_supports("fma");
+}
+#endif
+
+#ifdef __SSE2__
+static int apply_aos_sse(const float m[static 9], float *out,
+		const float *in, int n, bool proj)
+{
+	const __m128 a = _mm_setr_ps(m[0], m[3], m[0], m[3]);
+	const __m128 b = _mm_setr_ps(m[1], m[4], m[1], m[4]);
+	const __m128 c = _mm_setr_ps(m[2], m[5], m[2], m[5]);
+	const __m128 wa = _mm_set1_ps(m[6]), wb = _mm_set1_ps(m[7]),
+		wc = _mm_set1_ps(m[8]);
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128 p = _mm_loadu_ps(in + 2 * i);
+		__m128 xs = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 ys = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xs, a),
+			_mm_mul_ps(ys, b)), c);
+		if (proj) {
+			r = _mm_div_ps(r, _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(xs, wa), _mm_mul_ps(ys, wb)), wc));
+		}
+		_mm_storeu_ps(out + 2 * i, r);
+	}
+	return i;
+}
+
+static int apply_soa_sse(const float m[static 9], float *out_x, float *out_y,
+		const float *x, const float *y, int n, bool proj)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+		__m128 rx = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(px, _mm_set1_ps(m[0])),
+			_mm_mul_ps(py, _mm_set1_ps(m[1]))), _mm_set1_ps(m[2]));
+		__m128 ry = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(px, _mm_set1_ps(m[3])),
+			_mm_mul_ps(py, _mm_set1_ps(m[4]))), _mm_set1_ps(m[5]));
+		if (proj) {
+			__m128 w = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(px, _mm_set1_ps(m[6])),
+				_mm_mul_ps(py, _mm_set1_ps(m[7]))),
+				_mm_set1_ps(m[8]));
+			rx = _mm_div_ps(rx, w);
+			ry = _mm_div_ps(ry, w);
+		}
+		_mm_storeu_ps(out_x + i, rx);
+		_mm_storeu_ps(out_y + i, ry);
+	}
+	return i;
+}
+#endif
+
+static void apply_aos(const float m[static 9], float *out, const float *in,
+		int n, bool proj)
+{
+	int i = 0;
+#ifdef HAVE_AVX_DISPATCH
+	if (have_avx_fma()) i = apply_aos_avx(m, out, in, n, proj);
+#endif
+#ifdef __SSE2__
+	i += apply_aos_sse(m, out + 2 * i, in + 2 * i, n - i, proj);
+#endif
+	apply_scalar(m, out + 2 * i, out + 2 * i + 1, in + 2 * i,
+		in + 2 * i + 1, 2, n - i, proj);
+}
+
+static void apply_soa(const float m[static 9], float *out_x, float *out_y,
+		const float *x, const float *y, int n, bool proj)
+{
+	int i = 0;
+#ifdef HAVE_AVX_DISPATCH
+	if (have_avx_fma()) i = apply_soa_avx(m, out_x, out_y, x, y, n, proj);
+#endif
+#ifdef __SSE2__
+	i += apply_soa_sse(m, out_x + i, out_y + i, x + i, y + i, n - i, proj);
+#endif
+	apply_scalar(m, out_x + i, out_y + i, x + i, y + i, 1, n - i, proj);
+}
+
+void mat3_apply(const float m[static 9], float *out, const float *in, int n)
+{
+	apply_aos(m, out, in, n, true);
+}
+
+void mat3_apply_affine(const float m[static 9], float *out, const float *in,
+		int n)
+{
+	apply_aos(m, out, in, n, false);
+}
+
+void mat3_apply_soa(const float m[static 9], float *out_x, float *out_y,
+		const float *x, const float *y, int n)
+{
+	apply_soa(m, out_x, out_y, x, y, n, true);
+}
+
+void mat3_apply_affine_soa(const float m[static 9], float *out_x,
+		float *out_y, const float *x, const float *y, int n)
+{
+	apply_soa(m, out_x, out_y, x, y, n, false);
+}
+
+void mat2x3_apply(const float m[static 6], float *out, const float *in,
+		int n)
+{
+	float m3[9];
+	mat2x3_to_mat3(m3, m);
+	apply_aos(m3, out, in, n, false);
+}
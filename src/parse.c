@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ds/parse.h>
+#include "core.h"
+#include "parse_pow5.h"
+
+static bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*
+ * SWAR digit conversion, with the first digit in the lowest byte. See
+ * Daniel Lemire, "Number Parsing at a Gigabyte per Second", Software:
+ * Practice and Experience 51(8), 2021.
+ */
+static bool is_eight_digits(uint64_t v) {
+	return !(((v & 0xf0f0f0f0f0f0f0f0)
+		| (((v + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4))
+		^ 0x3333333333333333);
+}
+static uint32_t parse_eight_digits(uint64_t v) {
+	const uint64_t mask = 0x000000ff000000ff;
+	const uint64_t mul1 = 100 + (1000000ull << 32);
+	const uint64_t mul2 = 1 + (10000ull << 32);
+	v -= 0x3030303030303030;
+	v = (v * 10) + (v >> 8); /* pairs of digits */
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return v;
+}
+#define HAVE_SWAR
+#endif
+
+/*
+ * Accumulates the digits of d[*i, len) into *v, at most max_digits of them.
+ * Returns the number of digits read.
+ */
+static int parse_digits(const char *d, int len, int *i, uint64_t *v,
+		int max_digits) {
+	int start = *i;
+#ifdef HAVE_SWAR
+	while (*i + 8 <= len && *i - start + 8 <= max_digits) {
+		uint64_t w;
+		memcpy(&w, d + *i, 8);
+		if (!is_eight_digits(w)) break;
+		*v = *v * 100000000 + parse_eight_digits(w);
+		*i += 8;
+	}
+#endif
+	while (*i < len && *i - start < max_digits && is_digit(d[*i])) {
+		*v = *v * 10 + (d[*i] - '0');
+		++*i;
+	}
+	return *i - start;
+}
+
+bool str_parse_u64(struct str_slice s, uint64_t *out) {
+	int i = 0;
+	if (s.len == 0) return false;
+	while (i + 1 < s.len && s.d[i] == '0') ++i;
+
+	/* 19 digits always fit, a 20th one may overflow */
+	uint64_t v = 0;
+	if (parse_digits(s.d, s.len, &i, &v, 19) == 0) return false;
+	if (i < s.len && is_digit(s.d[i])) {
+		int digit = s.d[i] - '0';
+		if (__builtin_mul_overflow(v, 10, &v)
+				|| __builtin_add_overflow(v, digit, &v)) {
+			return false;
+		}
+		++i;
+	}
+	if (i != s.len) return false;
+	*out = v;
+	return true;
+}
+
+bool str_parse_i64(struct str_slice s, int64_t *out) {
+	bool neg = false;
+	if (s.len > 0 && (s.d[0] == '-' || s.d[0] == '+')) {
+		neg = s.d[0] == '-';
+		++s.d;
+		--s.len;
+	}
+	uint64_t v;
+	if (!str_parse_u64(s, &v)) return false;
+	if (neg) {
+		if (v > (uint64_t)INT64_MAX + 1) return false;
+		*out = v == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)v;
+	} else {
+		if (v > INT64_MAX) return false;
+		*out = v;
+	}
+	return true;
+}
+
+/* the powers of ten that are exact in a double */
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/* the 128-bit product a * b */
+static void mul_64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)a * b;
+	*hi = p >> 64;
+	*lo = p;
+#else
+	uint64_t al = (uint32_t)a, ah = a >> 32, bl = (uint32_t)b, bh = b >> 32;
+	uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+	uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+	*hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	*lo = (mid << 32) | (uint32_t)ll;
+#endif
+}
+
+/*
+ * Eisel-Lemire: the bits of the double nearest to w * 10^q (w > 0), without
+ * the sign. The product of w with the 128-bit approximation of 5^q always
+ * has enough correct bits to round (Noble Mushtak and Daniel Lemire, "Fast
+ * Number Parsing Without Fallback", Software: Practice and Experience 53(6),
+ * 2023), the power of two only moves the exponent. Out of range values give
+ * 0 or the bits of infinity.
+ */
+static uint64_t eisel_lemire(uint64_t w, int q) {
+	const uint64_t inf = 0x7ffull << 52;
+	if (q < POW5_MIN) return 0;
+	if (q > POW5_MAX) return inf;
+
+	int lz = __builtin_clzll(w);
+	w <<= lz;
+	const uint64_t *p5 = pow5_128[q - POW5_MIN];
+	uint64_t hi, lo;
+	mul_64(w, p5[0], &hi, &lo);
+	/* the low half only matters if it can carry into the 55 bits used */
+	if ((hi & 0x1ff) == 0x1ff) {
+		uint64_t hi2, lo2;
+		mul_64(w, p5[1], &hi2, &lo2);
+		lo += hi2;
+		if (lo < hi2) ++hi;
+	}
+
+	int upper = hi >> 63;
+	/* 54 bits: the 53 of the mantissa and one to round with */
+	uint64_t m = hi >> (upper + 9);
+	/* floor(log2(10^q)) + 63 + upper - lz, plus the double exponent bias */
+	int e = (int)(((152170 + 65536) * (int64_t)q) >> 16) + 63 + upper
+		- lz + 1023;
+	if (e <= 0) {
+		/* subnormal, or 0 */
+		if (-e + 1 >= 64) return 0;
+		m >>= -e + 1;
+		m += m & 1;
+		m >>= 1;
+		/* rounding up may give the smallest normal number */
+		return m < (1ull << 52) ? m : 1ull << 52;
+	}
+	/* Exactly halfway between two doubles: round to even. Only possible
+	 * when 5^q fits into the product exactly, that is for small q. */
+	if (lo <= 1 && q >= -4 && q <= 23 && (m & 3) == 1
+			&& (m << (upper + 9)) == hi) {
+		m &= ~1ull;
+	}
+	m += m & 1;
+	m >>= 1;
+	if (m >= (2ull << 52)) {
+		m = 1ull << 52;
+		++e;
+	}
+	if (e >= 0x7ff) return inf;
+	return (m & ~(1ull << 52)) | (uint64_t)e << 52;
+}
+
+/*
+ * The decimal syntax of str_parse_double, without the sign, with more
+ * significant digits than fit into a uint64_t, so that the value is not known
+ * well enough to round it. strtod decides, on a short copy: the halfway
+ * points between doubles have at most 767 significant digits, so the first
+ * 769 are kept, followed by a 1 if any of the rest is not 0.
+ */
+#define SLOW_MAX_DIGITS 769
+static double parse_decimal_slow(const char *d, int len) {
+	char buf[SLOW_MAX_DIGITS + 32];
+	int i = 0, k = 0;
+	int digits = 0;
+	bool sticky = false;
+	/* the value is buf * 10^scale */
+	long long scale = 0;
+	bool frac = false;
+	for (; i < len && d[i] != 'e' && d[i] != 'E'; ++i) {
+		if (d[i] == '.') {
+			frac = true;
+			continue;
+		}
+		if (digits == 0 && d[i] == '0') {
+			scale -= frac;
+			continue;
+		}
+		if (digits < SLOW_MAX_DIGITS) {
+			buf[k++] = d[i];
+			++digits;
+			scale -= frac;
+		} else {
+			sticky = sticky || d[i] != '0';
+			scale += !frac;
+		}
+	}
+	if (sticky) {
+		buf[k++] = '1';
+		--scale;
+	}
+	if (i < len) {
+		/* the exponent was validated by the caller */
+		bool eneg = d[++i] == '-';
+		if (d[i] == '-' || d[i] == '+') ++i;
+		long long e = 0;
+		for (; i < len; ++i) {
+			if (e < 100000) e = e * 10 + (d[i] - '0');
+		}
+		scale += eneg ? -e : e;
+	}
+	snprintf(buf + k, sizeof(buf) - k, "e%lld", scale);
+	return strtod(buf, NULL);
+}
+
+/* Other forms (inf, nan, hex floats) through strtod, on a stack copy. Hex
+ * floats do not overflow to inf. */
+static bool parse_double_other(struct str_slice s, bool hex, double *out) {
+	char buf[128];
+	if (s.len >= sizeof(buf)) return false;
+	memcpy(buf, s.d, s.len);
+	buf[s.len] = '\0';
+	char *end;
+	double v = strtod(buf, &end);
+	if (end != buf + s.len || (hex && isinf(v))) return false;
+	*out = v;
+	return true;
+}
+
+bool str_parse_double(struct str_slice s, double *out) {
+	const char *d = s.d;
+	int len = s.len, i = 0;
+
+	bool neg = false;
+	if (i < len && (d[i] == '-' || d[i] == '+')) neg = d[i++] == '-';
+	int sign_len = i;
+	if (i < len && (d[i] == 'i' || d[i] == 'I' || d[i] == 'n'
+			|| d[i] == 'N')) {
+		return parse_double_other(s, false, out);
+	}
+	if (i + 1 < len && d[i] == '0' && (d[i + 1] == 'x' || d[i + 1] == 'X')) {
+		return parse_double_other(s, true, out);
+	}
+
+	/* mantissa digits, the leading zeros are not significant */
+	uint64_t m = 0;
+	int exp10 = 0;
+	int int_start = i;
+	while (i < len && d[i] == '0') ++i;
+	int n = parse_digits(d, len, &i, &m, 19);
+	bool truncated = i < len && is_digit(d[i]);
+	while (i < len && is_digit(d[i])) ++i, ++exp10;
+	int int_digits = i - int_start;
+
+	int frac_digits = 0;
+	if (i < len && d[i] == '.') {
+		int frac_start = ++i;
+		if (n == 0) {
+			while (i < len && d[i] == '0') ++i, --exp10;
+		}
+		if (!truncated) {
+			int k = parse_digits(d, len, &i, &m, 19 - n);
+			n += k;
+			exp10 -= k;
+		}
+		if (i < len && is_digit(d[i])) truncated = true;
+		while (i < len && is_digit(d[i])) ++i;
+		frac_digits = i - frac_start;
+	}
+	if (int_digits + frac_digits == 0) return false;
+
+	if (i < len && (d[i] == 'e' || d[i] == 'E')) {
+		++i;
+		bool eneg = false;
+		if (i < len && (d[i] == '-' || d[i] == '+')) {
+			eneg = d[i++] == '-';
+		}
+		if (i == len || !is_digit(d[i])) return false;
+		int e = 0;
+		for (; i < len && is_digit(d[i]); ++i) {
+			if (e < 100000) e = e * 10 + (d[i] - '0');
+		}
+		exp10 += eneg ? -e : e;
+	}
+	if (i != len) return false;
+
+	double v;
+	if (m == 0) {
+		v = 0;
+	} else if (!truncated && m <= (1ull << 53) && exp10 >= -22
+			&& exp10 <= 22 && FLT_EVAL_METHOD == 0) {
+		/* Clinger's fast path: m and 10^|exp10| are exact doubles,
+		 * and a single multiplication or division rounds correctly. */
+		v = m;
+		v = exp10 < 0 ? v / exact_pow10[-exp10]
+			: v * exact_pow10[exp10];
+	} else {
+		uint64_t bits = eisel_lemire(m, exp10);
+		/* With digits cut off, the value is in [m, m + 1) * 10^exp10,
+		 * and it is only known if both ends round the same way. */
+		if (truncated && eisel_lemire(m + 1, exp10) != bits) {
+			v = parse_decimal_slow(d + sign_len, len - sign_len);
+		} else {
+			memcpy(&v, &bits, sizeof(v));
+		}
+	}
+	if (isinf(v)) return false;
+	*out = neg ? -v : v;
+	return true;
+}
+
+bool str_parse_i64_column(const struct vec *fields, struct vec *out,
+		int *bad) {
+	asrt(fields->itemsize == sizeof(struct str_slice), "bad fields");
+	asrt(out->itemsize == sizeof(int64_t), "bad out itemsize");
+	if (!vec_grow(out, fields->len)) {
+		*bad = -1;
+		return false;
+	}
+	const struct str_slice *f = fields->d;
+	int64_t *o = (int64_t *)out->d + out->len;
+	for (int i = 0; i < fields->len; ++i) {
+		if (!str_parse_i64(f[i], &o[i])) {
+			out->len += i;
+			*bad = i;
+			return false;
+		}
+	}
+	out->len += fields->len;
+	return true;
+}
+
+bool str_parse_double_column(const struct vec *fields, struct vec *out,
+		int *bad) {
+	asrt(fields->itemsize == sizeof(struct str_slice), "bad fields");
+	asrt(out->itemsize == sizeof(double), "bad out itemsize");
+	if (!vec_grow(out, fields->len)) {
+		*bad = -1;
+		return false;
+	}
+	const struct str_slice *f = fields->d;
+	double *o = (double *)out->d + out->len;
+	for (int i = 0; i < fields->len; ++i) {
+		if (!str_parse_double(f[i], &o[i])) {
+			out->len += i;
+			*bad = i;
+			return false;
+		}
+	}
+	out->len += fields->len;
+	return true;
+}
@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <ds/iter.h>
+#include "core.h"
+#include "iter_internal.h"
+
+/* needles at least this long are searched with Two-Way */
+#define TWO_WAY_MIN_LEN 32
+
+static int maxi(int a, int b) { return a < b ? b : a; }
+
+/*
+ * For short needles: candidate positions are where both the first and the
+ * last byte of the needle match, 16 positions at a time with SSE2, and only
+ * those are compared fully. n has at least 2 bytes.
+ */
+static int find_short(const unsigned char *h, int hl, int from,
+		const unsigned char *n, int l) {
+	int i = from;
+#ifdef __SSE2__
+	__m128i first = _mm_set1_epi8(n[0]), last = _mm_set1_epi8(n[l - 1]);
+	for (; i + l - 1 + 16 <= hl; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(h + i + l - 1));
+		unsigned m = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (m) {
+			int j = i + __builtin_ctz(m);
+			if (memcmp(h + j + 1, n + 1, l - 2) == 0) return j;
+			m &= m - 1;
+		}
+	}
+#endif
+	for (; i + l <= hl; ++i) {
+		const unsigned char *p = memchr(h + i, n[0], hl - l + 1 - i);
+		if (!p) break;
+		i = p - h;
+		if (h[i + l - 1] == n[l - 1] && memcmp(h + i, n, l) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Two-Way string matching (Crochemore and Perrin, "Two-way string-matching",
+ * J. ACM 38(3), 1991): O(hl + l) time, O(1) space. The needle is cut at a
+ * critical factorization n[0, ms] n[ms + 1, l); the right part is matched
+ * first, left to right, then the left part right to left.
+ */
+static int find_two_way(const unsigned char *h, int hl, int from,
+		const unsigned char *n, int l) {
+	/* maximal suffix, for both orders of the alphabet */
+	int ip = -1, jp = 0, k = 1, p = 1;
+	while (jp + k < l) {
+		if (n[ip + k] == n[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				++k;
+			}
+		} else if (n[ip + k] > n[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	int ms = ip, p0 = p;
+
+	ip = -1, jp = 0, k = 1, p = 1;
+	while (jp + k < l) {
+		if (n[ip + k] == n[jp + k]) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				++k;
+			}
+		} else if (n[ip + k] < n[jp + k]) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	if (ip > ms) {
+		ms = ip;
+	} else {
+		p = p0;
+	}
+
+	/* if the needle is periodic, remember the matched prefix on shifts */
+	int mem0;
+	if (memcmp(n, n + p, ms + 1) != 0) {
+		mem0 = 0;
+		p = maxi(ms, l - ms - 1) + 1;
+	} else {
+		mem0 = l - p;
+	}
+
+	int mem = 0;
+	for (int pos = from; pos + l <= hl; ) {
+		for (k = maxi(ms + 1, mem); k < l && n[k] == h[pos + k]; ++k);
+		if (k < l) {
+			pos += k - ms;
+			mem = 0;
+			continue;
+		}
+		for (k = ms + 1; k > mem && n[k - 1] == h[pos + k - 1]; --k);
+		if (k <= mem) return pos;
+		pos += p;
+		mem = mem0;
+	}
+	return -1;
+}
+
+int str_find(struct str_slice hay, struct str_slice needle, int from) {
+	asrt(from >= 0 && from <= hay.len, "bad str_find start");
+	const unsigned char *h = (const unsigned char *)hay.d;
+	const unsigned char *n = (const unsigned char *)needle.d;
+	if (needle.len == 0) return from;
+	if (needle.len > hay.len - from) return -1;
+	if (needle.len == 1) {
+		const unsigned char *p = memchr(h + from, n[0], hay.len - from);
+		return p ? p - h : -1;
+	}
+	if (needle.len < TWO_WAY_MIN_LEN) {
+		return find_short(h, hay.len, from, n, needle.len);
+	}
+	return find_two_way(h, hay.len, from, n, needle.len);
+}
+
+/*
+ * Aho-Corasick automaton, with the goto function completed into a DFA, so
+ * that matching takes one table lookup per input byte. Node 0 is the root.
+ */
+struct ac_node {
+	int next[256];
+	int fail;
+	int out; /* pattern ending here, or -1 */
+	int out_link; /* nearest node on the fail chain with out >= 0, or -1 */
+};
+
+static struct ac_node *ac_node(const struct str_matcher *m, int i) {
+	return (struct ac_node *)m->nodes.d + i;
+}
+
+static int ac_new_node(struct str_matcher *m) {
+	struct ac_node node = { .fail = 0, .out = -1, .out_link = -1 };
+	memset(node.next, -1, sizeof(node.next));
+	return vec_append(&m->nodes, &node);
+}
+
+bool str_matcher_init(struct str_matcher *m, const struct str_slice *patterns,
+		int n) {
+	m->nodes = vec_new_empty(sizeof(struct ac_node));
+	m->lens = vec_new_empty(sizeof(int));
+	struct vec queue = vec_new_empty(sizeof(int));
+	if (ac_new_node(m) < 0) goto err;
+
+	for (int i = 0; i < n; ++i) {
+		asrt(patterns[i].len > 0, "empty pattern");
+		if (vec_append(&m->lens, &patterns[i].len) < 0) goto err;
+		int u = 0;
+		for (int j = 0; j < patterns[i].len; ++j) {
+			unsigned char c = patterns[i].d[j];
+			if (ac_node(m, u)->next[c] < 0) {
+				int v = ac_new_node(m);
+				if (v < 0) goto err;
+				ac_node(m, u)->next[c] = v;
+			}
+			u = ac_node(m, u)->next[c];
+		}
+		/* for duplicates, the first pattern is reported */
+		if (ac_node(m, u)->out < 0) ac_node(m, u)->out = i;
+	}
+
+	/* Breadth first, so the fail node of each node is done before it. At
+	 * that point the next entries of u are either -1 or its children. */
+	int zero = 0;
+	if (vec_append(&queue, &zero) < 0) goto err;
+	for (int qi = 0; qi < queue.len; ++qi) {
+		int u = *(int *)vec_get(&queue, qi);
+		struct ac_node *un = ac_node(m, u);
+		for (int c = 0; c < 256; ++c) {
+			int v = un->next[c];
+			if (v < 0) {
+				un->next[c] = u == 0 ? 0
+					: ac_node(m, un->fail)->next[c];
+				continue;
+			}
+			struct ac_node *vn = ac_node(m, v);
+			vn->fail = u == 0 ? 0 : ac_node(m, un->fail)->next[c];
+			struct ac_node *fn = ac_node(m, vn->fail);
+			vn->out_link = fn->out >= 0 ? vn->fail : fn->out_link;
+			if (vec_append(&queue, &v) < 0) goto err;
+		}
+	}
+	vec_free(&queue);
+	return true;
+err:
+	vec_free(&queue);
+	str_matcher_finish(m);
+	return false;
+}
+
+void str_matcher_finish(struct str_matcher *m) {
+	vec_free(&m->nodes);
+	vec_free(&m->lens);
+}
+
+bool str_gen_find_next(struct str_gen *g, struct str_slice *res) {
+	struct str_slice s = g->find.s, needle = g->find.needle;
+	if (g->find.i > s.len) return false;
+	int pos = str_find(s, needle, g->find.i);
+	if (pos < 0) {
+		g->find.i = s.len + 1;
+		return false;
+	}
+	*res = (struct str_slice){ .d = s.d + pos, .len = needle.len };
+	g->find.i = pos + needle.len;
+	return true;
+}
+
+bool str_gen_find_any_next(struct str_gen *g, struct str_slice *res) {
+	const struct str_matcher *m = g->find_any.m;
+	for (;;) {
+		int u = g->find_any.pending;
+		if (u >= 0) {
+			struct ac_node *un = ac_node(m, u);
+			int len = *(int *)vec_get_c(&m->lens, un->out);
+			*res = (struct str_slice){
+				.d = g->find_any.s.d + g->find_any.i - len,
+				.len = len,
+			};
+			g->find_any.pattern = un->out;
+			g->find_any.pending = un->out_link;
+			return true;
+		}
+		if (g->find_any.i >= g->find_any.s.len) return false;
+
+		unsigned char c = g->find_any.s.d[g->find_any.i++];
+		u = ac_node(m, g->find_any.state)->next[c];
+		g->find_any.state = u;
+		struct ac_node *un = ac_node(m, u);
+		g->find_any.pending = un->out >= 0 ? u : un->out_link;
+	}
+}
+
+struct str_gen str_gen_find(struct str_slice s, struct str_slice needle) {
+	asrt(needle.len > 0, "empty needle");
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_FIND,
+		.find = { .s = s, .needle = needle, .i = 0 },
+	};
+}
+struct str_gen str_gen_find_any(struct str_slice s,
+		const struct str_matcher *m) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_FIND_ANY,
+		.find_any = {
+			.m = m, .s = s, .i = 0,
+			.state = 0, .pending = -1, .pattern = -1,
+		},
+	};
+}
+int str_gen_find_any_pattern(const struct str_gen *g) {
+	asrt(g->kind == STR_GEN_KIND_FIND_ANY, "not a find_any generator");
+	return g->find_any.pattern;
+}
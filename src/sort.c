@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ds/sort.h>
+#include "core.h"
+
+/*
+ * pdqsort on elements of a runtime size, a direct translation of
+ * DS_SORT_DEFINE. Elements are moved with memcpy through two scratch
+ * elements (tmp and pivot).
+ */
+
+struct sort_ctx {
+	size_t size;
+	int (*cmp)(const void *a, const void *b);
+	char *tmp, *pivot;
+};
+
+#define LT(a, b) (c->cmp((a), (b)) < 0)
+#define AT(p, i) ((p) + (ptrdiff_t)(i) * (ptrdiff_t)c->size)
+
+static void swap(struct sort_ctx *c, char *a, char *b) {
+	memcpy(c->tmp, a, c->size);
+	memcpy(a, b, c->size);
+	memcpy(b, c->tmp, c->size);
+}
+static void sort2(struct sort_ctx *c, char *a, char *b) {
+	if (LT(b, a)) swap(c, a, b);
+}
+static void sort3(struct sort_ctx *c, char *a, char *b, char *d) {
+	sort2(c, a, b);
+	sort2(c, b, d);
+	sort2(c, a, b);
+}
+
+/* returns the number of moved elements, or -1 when exceeding limit */
+static int insertion(struct sort_ctx *c, char *begin, char *end,
+		bool unguarded, int limit) {
+	int moved = 0;
+	if (begin == end) return 0;
+	for (char *cur = AT(begin, 1); cur != end; cur = AT(cur, 1)) {
+		if (!LT(cur, AT(cur, -1))) continue;
+		memcpy(c->tmp, cur, c->size);
+		char *sift = cur;
+		do {
+			memcpy(sift, AT(sift, -1), c->size);
+			sift = AT(sift, -1);
+		} while ((unguarded || sift != begin)
+			&& LT(c->tmp, AT(sift, -1)));
+		memcpy(sift, c->tmp, c->size);
+		moved += (cur - sift) / c->size;
+		if (limit >= 0 && moved > limit) return -1;
+	}
+	return moved;
+}
+
+static void sift_down(struct sort_ctx *c, char *a, int i, int n) {
+	memcpy(c->pivot, AT(a, i), c->size);
+	for (;;) {
+		int ch = 2 * i + 1;
+		if (ch >= n) break;
+		if (ch + 1 < n && LT(AT(a, ch), AT(a, ch + 1))) ++ch;
+		if (!LT(c->pivot, AT(a, ch))) break;
+		memcpy(AT(a, i), AT(a, ch), c->size);
+		i = ch;
+	}
+	memcpy(AT(a, i), c->pivot, c->size);
+}
+static void heapsort(struct sort_ctx *c, char *a, int n) {
+	for (int i = n / 2 - 1; i >= 0; --i) sift_down(c, a, i, n);
+	for (int i = n - 1; i > 0; --i) {
+		swap(c, a, AT(a, i));
+		sift_down(c, a, 0, i);
+	}
+}
+
+static char *partition_right(struct sort_ctx *c, char *begin, char *end,
+		bool *already_partitioned) {
+	memcpy(c->pivot, begin, c->size);
+	char *first = begin, *last = end;
+	while (first = AT(first, 1), LT(first, c->pivot));
+	if (AT(first, -1) == begin) {
+		while (first < last && (last = AT(last, -1),
+			!LT(last, c->pivot)));
+	} else {
+		while (last = AT(last, -1), !LT(last, c->pivot));
+	}
+	*already_partitioned = first >= last;
+	while (first < last) {
+		swap(c, first, last);
+		while (first = AT(first, 1), LT(first, c->pivot));
+		while (last = AT(last, -1), !LT(last, c->pivot));
+	}
+	char *pivot_pos = AT(first, -1);
+	memcpy(begin, pivot_pos, c->size);
+	memcpy(pivot_pos, c->pivot, c->size);
+	return pivot_pos;
+}
+
+static char *partition_left(struct sort_ctx *c, char *begin, char *end) {
+	memcpy(c->pivot, begin, c->size);
+	char *first = begin, *last = end;
+	while (last = AT(last, -1), LT(c->pivot, last));
+	if (AT(last, 1) == end) {
+		while (first < last && (first = AT(first, 1),
+			!LT(c->pivot, first)));
+	} else {
+		while (first = AT(first, 1), !LT(c->pivot, first));
+	}
+	while (first < last) {
+		swap(c, first, last);
+		while (last = AT(last, -1), LT(c->pivot, last));
+		while (first = AT(first, 1), !LT(c->pivot, first));
+	}
+	char *pivot_pos = last;
+	memcpy(begin, pivot_pos, c->size);
+	memcpy(pivot_pos, c->pivot, c->size);
+	return pivot_pos;
+}
+
+static void pdq_loop(struct sort_ctx *c, char *begin, char *end,
+		int bad_allowed, bool leftmost) {
+	for (;;) {
+		int size = (end - begin) / c->size;
+		if (size < DS_SORT_INSERTION_THRESHOLD) {
+			insertion(c, begin, end, !leftmost, -1);
+			return;
+		}
+		int s2 = size / 2;
+		if (size > DS_SORT_NINTHER_THRESHOLD) {
+			sort3(c, begin, AT(begin, s2), AT(end, -1));
+			sort3(c, AT(begin, 1), AT(begin, s2 - 1), AT(end, -2));
+			sort3(c, AT(begin, 2), AT(begin, s2 + 1), AT(end, -3));
+			sort3(c, AT(begin, s2 - 1), AT(begin, s2),
+				AT(begin, s2 + 1));
+			swap(c, begin, AT(begin, s2));
+		} else {
+			sort3(c, AT(begin, s2), begin, AT(end, -1));
+		}
+		if (!leftmost && !LT(AT(begin, -1), begin)) {
+			begin = AT(partition_left(c, begin, end), 1);
+			continue;
+		}
+		bool already;
+		char *p = partition_right(c, begin, end, &already);
+		int l = (p - begin) / c->size;
+		int r = (end - p) / c->size - 1;
+		if (l < size / 8 || r < size / 8) {
+			if (--bad_allowed == 0) {
+				heapsort(c, begin, size);
+				return;
+			}
+			if (l >= DS_SORT_INSERTION_THRESHOLD) {
+				swap(c, begin, AT(begin, l / 4));
+				swap(c, AT(p, -1), AT(p, -(l / 4)));
+				if (l > DS_SORT_NINTHER_THRESHOLD) {
+					swap(c, AT(begin, 1),
+						AT(begin, l / 4 + 1));
+					swap(c, AT(begin, 2),
+						AT(begin, l / 4 + 2));
+					swap(c, AT(p, -2), AT(p, -(l / 4 + 1)));
+					swap(c, AT(p, -3), AT(p, -(l / 4 + 2)));
+				}
+			}
+			if (r >= DS_SORT_INSERTION_THRESHOLD) {
+				swap(c, AT(p, 1), AT(p, 1 + r / 4));
+				swap(c, AT(end, -1), AT(end, -(r / 4)));
+				if (r > DS_SORT_NINTHER_THRESHOLD) {
+					swap(c, AT(p, 2), AT(p, 2 + r / 4));
+					swap(c, AT(p, 3), AT(p, 3 + r / 4));
+					swap(c, AT(end, -2),
+						AT(end, -(1 + r / 4)));
+					swap(c, AT(end, -3),
+						AT(end, -(2 + r / 4)));
+				}
+			}
+		} else if (already
+				&& insertion(c, begin, p, false,
+					DS_SORT_PARTIAL_INSERTION_LIMIT) >= 0
+				&& insertion(c, AT(p, 1), end, false,
+					DS_SORT_PARTIAL_INSERTION_LIMIT) >= 0) {
+			return;
+		}
+		pdq_loop(c, begin, p, bad_allowed, leftmost);
+		begin = AT(p, 1);
+		leftmost = false;
+	}
+}
+
+static void sort_array(void *a, int n, size_t size,
+		int (*cmp)(const void *a, const void *b)) {
+	/* scratch elements, on the stack for the usual small sizes */
+	_Alignas(max_align_t) char small[2 * 64];
+	char *scratch = size <= 64 ? small : malloc(2 * size);
+	if (!scratch) {
+		qsort(a, n, size, cmp);
+		return;
+	}
+	struct sort_ctx c = {
+		.size = size, .cmp = cmp,
+		.tmp = scratch, .pivot = scratch + size,
+	};
+	int log2n = 0;
+	while ((1 << log2n) < n) ++log2n;
+	pdq_loop(&c, a, (char *)a + n * size, log2n + 1, true);
+	if (scratch != small) free(scratch);
+}
+
+void vec_sort(struct vec *v, int (*cmp)(const void *a, const void *b)) {
+	sort_array(v->d, v->len, v->itemsize, cmp);
+}
+
+int vec_lower_bound(const struct vec *v, const void *key,
+		int (*cmp)(const void *a, const void *b)) {
+	int lo = 0, n = v->len;
+	while (n > 0) {
+		int half = n / 2;
+		if (cmp(vec_get_c(v, lo + half), key) < 0) {
+			lo += half + 1;
+			n -= half + 1;
+		} else {
+			n = half;
+		}
+	}
+	return lo;
+}
+
+int vec_bsearch(const struct vec *v, const void *key,
+		int (*cmp)(const void *a, const void *b)) {
+	int i = vec_lower_bound(v, key, cmp);
+	if (i < v->len && cmp(vec_get_c(v, i), key) == 0) return i;
+	return -1;
+}
+
+static uint64_t radix_key(const char *e, size_t key_size) {
+	switch (key_size) {
+	case 1: { uint8_t k; memcpy(&k, e, 1); return k; }
+	case 2: { uint16_t k; memcpy(&k, e, 2); return k; }
+	case 4: { uint32_t k; memcpy(&k, e, 4); return k; }
+	default: { uint64_t k; memcpy(&k, e, 8); return k; }
+	}
+}
+
+bool vec_radix_sort(struct vec *v, size_t key_offset, size_t key_size,
+		bool is_signed) {
+	asrt(key_size == 1 || key_size == 2 || key_size == 4
+		|| key_size == 8, "bad key size");
+	asrt(key_offset + key_size <= v->itemsize, "key out of element");
+	if (v->len < 2) return true;
+
+	size_t n = v->len, size = v->itemsize;
+	char *tmp = allocator_alloc(v->alloc, n * size);
+	if (!tmp) return false;
+
+	/* flipping the sign bit maps two's complement order to unsigned */
+	uint64_t flip = is_signed ? (uint64_t)1 << (8 * key_size - 1) : 0;
+
+	/* one pass for the histograms of all digits */
+	size_t count[8][256] = { { 0 } };
+	char *src = v->d;
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t k = radix_key(src + i * size + key_offset, key_size)
+			^ flip;
+		for (size_t d = 0; d < key_size; ++d) {
+			++count[d][(k >> (8 * d)) & 0xff];
+		}
+	}
+
+	char *dst = tmp;
+	for (size_t d = 0; d < key_size; ++d) {
+		/* all the keys have the same digit here */
+		if (count[d][(radix_key(src + key_offset, key_size) ^ flip)
+				>> (8 * d) & 0xff] == n) {
+			continue;
+		}
+
+		size_t pos[256], sum = 0;
+		for (int b = 0; b < 256; ++b) {
+			pos[b] = sum;
+			sum += count[d][b];
+		}
+		for (size_t i = 0; i < n; ++i) {
+			const char *e = src + i * size;
+			uint64_t k = radix_key(e + key_offset, key_size) ^ flip;
+			memcpy(dst + pos[(k >> (8 * d)) & 0xff]++ * size, e,
+				size);
+		}
+		char *t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != v->d) {
+		memcpy(v->d, src, n * size);
+		allocator_free(v->alloc, src, n * size);
+	} else {
+		allocator_free(v->alloc, dst, n * size);
+	}
+	return true;
+}
+
+/* below this, vec_sort_parallel does not start threads */
+#define PARALLEL_MIN_LEN (1 << 16)
+#define PARALLEL_MAX_THREADS 64
+
+struct sort_job {
+	int (*cmp)(const void *a, const void *b);
+	size_t size;
+	/* sort: [a, a + na) in place
+	 * merge: [a, a + na) and [b, b + nb) into out */
+	char *a, *b, *out;
+	size_t na, nb;
+};
+
+static void *sort_job_sort(void *arg) {
+	struct sort_job *j = arg;
+	sort_array(j->a, j->na, j->size, j->cmp);
+	return NULL;
+}
+
+static void *sort_job_merge(void *arg) {
+	struct sort_job *j = arg;
+	char *a = j->a, *b = j->b, *out = j->out;
+	char *a_end = a + j->na * j->size, *b_end = b + j->nb * j->size;
+	while (a < a_end && b < b_end) {
+		/* take from a on ties, so merges keep the chunk order */
+		if (j->cmp(b, a) < 0) {
+			memcpy(out, b, j->size);
+			b += j->size;
+		} else {
+			memcpy(out, a, j->size);
+			a += j->size;
+		}
+		out += j->size;
+	}
+	memcpy(out, a, a_end - a);
+	out += a_end - a;
+	memcpy(out, b, b_end - b);
+	return NULL;
+}
+
+/* Runs the jobs on threads (the first one on the calling thread). */
+static void run_jobs(struct sort_job *jobs, int n, void *(*f)(void *)) {
+	pthread_t th[PARALLEL_MAX_THREADS];
+	bool started[PARALLEL_MAX_THREADS];
+	for (int i = 1; i < n; ++i) {
+		started[i] = pthread_create(&th[i], NULL, f, &jobs[i]) == 0;
+	}
+	f(&jobs[0]);
+	for (int i = 1; i < n; ++i) {
+		if (started[i]) {
+			pthread_join(th[i], NULL);
+		} else {
+			f(&jobs[i]);
+		}
+	}
+}
+
+void vec_sort_parallel(struct vec *v,
+		int (*cmp)(const void *a, const void *b), int nthreads) {
+	size_t n = v->len, size = v->itemsize;
+	if (nthreads < 2 || n < PARALLEL_MIN_LEN) {
+		vec_sort(v, cmp);
+		return;
+	}
+	char *tmp = allocator_alloc(v->alloc, n * size);
+	if (!tmp) {
+		vec_sort(v, cmp);
+		return;
+	}
+
+	/* chunk boundaries, as element indices */
+	int k = nthreads < PARALLEL_MAX_THREADS
+		? nthreads : PARALLEL_MAX_THREADS;
+	size_t bound[PARALLEL_MAX_THREADS + 1];
+	for (int i = 0; i <= k; ++i) bound[i] = n * i / k;
+
+	struct sort_job jobs[PARALLEL_MAX_THREADS];
+	for (int i = 0; i < k; ++i) {
+		jobs[i] = (struct sort_job){
+			.cmp = cmp, .size = size,
+			.a = (char *)v->d + bound[i] * size,
+			.na = bound[i + 1] - bound[i],
+		};
+	}
+	run_jobs(jobs, k, sort_job_sort);
+
+	/* merge neighbouring runs until there is one left */
+	char *src = v->d, *dst = tmp;
+	while (k > 1) {
+		int m = 0;
+		for (int i = 0; i < k; i += 2) {
+			size_t hi = i + 2 <= k ? bound[i + 2] : bound[i + 1];
+			jobs[m++] = (struct sort_job){
+				.cmp = cmp, .size = size,
+				.a = src + bound[i] * size,
+				.na = bound[i + 1] - bound[i],
+				.b = src + bound[i + 1] * size,
+				.nb = hi - bound[i + 1],
+				.out = dst + bound[i] * size,
+			};
+		}
+		run_jobs(jobs, m, sort_job_merge);
+
+		for (int i = 0; i < m; ++i) {
+			bound[i] = bound[2 * i];
+		}
+		bound[m] = n;
+		k = m;
+		char *t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if (src != v->d) memcpy(v->d, src, n * size);
+	allocator_free(v->alloc, tmp, n * size);
+}
@@ -0,0 +1,608 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <ds/matrix.h>
+#include <ds/sort.h>
+#include <ds/spatial.h>
+#include "core.h"
+
+#define NODE AABB_TREE_NODE_SIZE
+
+/*
+ * Tree nodes keep their entries in SoA layout, unused entries are empty boxes
+ * (min +inf, max -inf) so they fail every test without special casing. In
+ * leaves idx is the index of the box, otherwise the index of the child node.
+ */
+struct node {
+	float min_x[NODE], min_y[NODE], max_x[NODE], max_y[NODE];
+	int idx[NODE];
+	int n;
+};
+
+/* A tree over INT_MAX boxes has 8 levels, each adding at most NODE - 1
+ * pending nodes to the traversal stack. */
+#define STACK_SIZE (8 * NODE)
+
+/* Candidates of the nearest queries, in a binary min-heap on d. */
+struct cand {
+	float d;
+	int i;
+};
+
+static bool heap_push(struct vec *h, struct cand c) {
+	if (vec_append(h, &c) < 0) return false;
+	struct cand *a = h->d;
+	int i = h->len - 1;
+	while (i > 0) {
+		int p = (i - 1) / 2;
+		if (a[p].d <= c.d) break;
+		a[i] = a[p];
+		i = p;
+	}
+	a[i] = c;
+	return true;
+}
+
+static struct cand heap_pop(struct vec *h) {
+	struct cand *a = h->d;
+	struct cand top = a[0], last = a[--h->len];
+	int n = h->len, i = 0;
+	if (n == 0) return top;
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= n) break;
+		if (c + 1 < n && a[c + 1].d < a[c].d) ++c;
+		if (last.d <= a[c].d) break;
+		a[i] = a[c];
+		i = c;
+	}
+	a[i] = last;
+	return top;
+}
+
+/* Squared distance of p to the closed box [min_x, max_x] x [min_y, max_y]. */
+static float dist2(float min_x, float min_y, float max_x, float max_y,
+		const float p[static 2]) {
+	float dx = fmaxf(fmaxf(min_x - p[0], p[0] - max_x), 0);
+	float dy = fmaxf(fmaxf(min_y - p[1], p[1] - max_y), 0);
+	return dx * dx + dy * dy;
+}
+
+/*
+ * Entry masks of a node. The point test is aabb_contains, the rectangle test
+ * is a positive area aabb_intersect, with the same float operations, so the
+ * results are the same as with the matrix.h functions (except for NaNs). For
+ * inner nodes the tests are conservative, since the bounds of a node contain
+ * the bounds of its entries.
+ */
+static unsigned mask_point(const struct node *nd, const float p[static 2]) {
+	unsigned mask = 0;
+#ifdef __SSE2__
+	__m128 x = _mm_set1_ps(p[0]), y = _mm_set1_ps(p[1]);
+	for (int i = 0; i < NODE; i += 4) {
+		__m128 in_x = _mm_and_ps(
+			_mm_cmple_ps(_mm_loadu_ps(nd->min_x + i), x),
+			_mm_cmplt_ps(x, _mm_loadu_ps(nd->max_x + i)));
+		__m128 in_y = _mm_and_ps(
+			_mm_cmple_ps(_mm_loadu_ps(nd->min_y + i), y),
+			_mm_cmplt_ps(y, _mm_loadu_ps(nd->max_y + i)));
+		mask |= (unsigned)_mm_movemask_ps(_mm_and_ps(in_x, in_y)) << i;
+	}
+#else
+	for (int i = 0; i < NODE; ++i) {
+		if (p[0] >= nd->min_x[i] && p[0] < nd->max_x[i]
+				&& p[1] >= nd->min_y[i]
+				&& p[1] < nd->max_y[i]) {
+			mask |= 1u << i;
+		}
+	}
+#endif
+	return mask;
+}
+
+static unsigned mask_rect(const struct node *nd, const float r[static 4]) {
+	const float r_max_x = r[0] + r[2], r_max_y = r[1] + r[3];
+	unsigned mask = 0;
+#ifdef __SSE2__
+	__m128 x0 = _mm_set1_ps(r[0]), y0 = _mm_set1_ps(r[1]);
+	__m128 x1 = _mm_set1_ps(r_max_x), y1 = _mm_set1_ps(r_max_y);
+	__m128 zero = _mm_setzero_ps();
+	for (int i = 0; i < NODE; i += 4) {
+		__m128 w = _mm_sub_ps(
+			_mm_min_ps(_mm_loadu_ps(nd->max_x + i), x1),
+			_mm_max_ps(_mm_loadu_ps(nd->min_x + i), x0));
+		__m128 h = _mm_sub_ps(
+			_mm_min_ps(_mm_loadu_ps(nd->max_y + i), y1),
+			_mm_max_ps(_mm_loadu_ps(nd->min_y + i), y0));
+		__m128 hit = _mm_and_ps(_mm_cmpgt_ps(w, zero),
+			_mm_cmpgt_ps(h, zero));
+		mask |= (unsigned)_mm_movemask_ps(hit) << i;
+	}
+#else
+	for (int i = 0; i < NODE; ++i) {
+		float w = fminf(nd->max_x[i], r_max_x)
+			- fmaxf(nd->min_x[i], r[0]);
+		float h = fminf(nd->max_y[i], r_max_y)
+			- fmaxf(nd->min_y[i], r[1]);
+		if (w > 0 && h > 0) mask |= 1u << i;
+	}
+#endif
+	return mask;
+}
+
+static void node_init(struct node *nd) {
+	for (int i = 0; i < NODE; ++i) {
+		nd->min_x[i] = nd->min_y[i] = INFINITY;
+		nd->max_x[i] = nd->max_y[i] = -INFINITY;
+		nd->idx[i] = -1;
+	}
+	nd->n = 0;
+}
+
+/* b is min_x, min_y, max_x, max_y */
+static void node_add(struct node *nd, const float b[static 4], int idx) {
+	int i = nd->n++;
+	nd->min_x[i] = b[0];
+	nd->min_y[i] = b[1];
+	nd->max_x[i] = b[2];
+	nd->max_y[i] = b[3];
+	nd->idx[i] = idx;
+}
+
+static void node_bounds(const struct node *nd, float b[static 4]) {
+	b[0] = b[1] = INFINITY;
+	b[2] = b[3] = -INFINITY;
+	for (int i = 0; i < nd->n; ++i) {
+		b[0] = fminf(b[0], nd->min_x[i]);
+		b[1] = fminf(b[1], nd->min_y[i]);
+		b[2] = fmaxf(b[2], nd->max_x[i]);
+		b[3] = fmaxf(b[3], nd->max_y[i]);
+	}
+}
+
+/* Index of (x, y) on a Hilbert curve filling a 2^16 x 2^16 grid. */
+static uint32_t hilbert(uint32_t x, uint32_t y) {
+	const uint32_t n = 1u << 16;
+	uint32_t d = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1) {
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			uint32_t t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
+
+static uint32_t quantize(float v, float lo, float scale) {
+	float f = (v - lo) * scale;
+	if (!(f >= 0)) return 0;
+	return f < 65535 ? f : 65535;
+}
+
+#define key_lt(a, b) ((a) < (b))
+DS_SORT_DEFINE(sort_keys, uint64_t, key_lt)
+
+bool aabb_tree_build(struct aabb_tree *t, const float *boxes, int n,
+		const struct allocator *alloc) {
+	t->nodes = vec_new_with_alloc(sizeof(struct node), alloc);
+	t->leaves = 0;
+	if (n == 0) return true;
+
+	int total = 0;
+	for (int l = n; l > 1 || total == 0; ) {
+		l = (l + NODE - 1) / NODE;
+		total += l;
+	}
+	struct vec keys = vec_new_with_alloc(sizeof(uint64_t), alloc);
+	if (!vec_reserve(&keys, n) || !vec_reserve(&t->nodes, total)) {
+		vec_free(&keys);
+		vec_free(&t->nodes);
+		return false;
+	}
+
+	/* sort the boxes along the Hilbert curve through their centers */
+	float lo[2] = { INFINITY, INFINITY }, hi[2] = { -INFINITY, -INFINITY };
+	for (int i = 0; i < n; ++i) {
+		const float *b = boxes + 4 * i;
+		for (int j = 0; j < 2; ++j) {
+			float c = b[j] + b[2 + j] / 2;
+			lo[j] = fminf(lo[j], c);
+			hi[j] = fmaxf(hi[j], c);
+		}
+	}
+	float scale[2];
+	for (int j = 0; j < 2; ++j) {
+		scale[j] = hi[j] > lo[j] ? 65535 / (hi[j] - lo[j]) : 0;
+	}
+	uint64_t *key = keys.d;
+	for (int i = 0; i < n; ++i) {
+		const float *b = boxes + 4 * i;
+		uint32_t x = quantize(b[0] + b[2] / 2, lo[0], scale[0]);
+		uint32_t y = quantize(b[1] + b[3] / 2, lo[1], scale[1]);
+		key[i] = (uint64_t)hilbert(x, y) << 32 | (uint32_t)i;
+	}
+	sort_keys(key, n);
+
+	struct node *nodes = t->nodes.d;
+	int len = 0;
+	for (int i = 0; i < n; ++i) {
+		if (i % NODE == 0) node_init(&nodes[len++]);
+		int j = (uint32_t)key[i];
+		const float *b = boxes + 4 * j;
+		const float mm[4] = { b[0], b[1], b[0] + b[2], b[1] + b[3] };
+		node_add(&nodes[len - 1], mm, j);
+	}
+	vec_free(&keys);
+	t->leaves = len;
+
+	/* pack each level into the next one, until there is a single node */
+	for (int begin = 0, end = len; end - begin > 1;
+			begin = end, end = len) {
+		for (int i = begin; i < end; ++i) {
+			if ((i - begin) % NODE == 0) node_init(&nodes[len++]);
+			float b[4];
+			node_bounds(&nodes[i], b);
+			node_add(&nodes[len - 1], b, i);
+		}
+	}
+	t->nodes.len = len;
+	return true;
+}
+
+void aabb_tree_finish(struct aabb_tree *t) {
+	vec_free(&t->nodes);
+}
+
+static bool tree_query(const struct aabb_tree *t, const float *q, bool rect,
+		struct vec *out) {
+	if (t->nodes.len == 0) return true;
+	const struct node *nodes = t->nodes.d;
+	int stack[STACK_SIZE], sp = 0;
+	stack[sp++] = t->nodes.len - 1;
+	while (sp > 0) {
+		int i = stack[--sp];
+		const struct node *nd = &nodes[i];
+		unsigned mask = rect ? mask_rect(nd, q) : mask_point(nd, q);
+		for (; mask; mask &= mask - 1) {
+			int j = __builtin_ctz(mask);
+			if (i >= t->leaves) {
+				stack[sp++] = nd->idx[j];
+			} else if (vec_append(out, &nd->idx[j]) < 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool aabb_tree_query_point(const struct aabb_tree *t, const float p[static 2],
+		struct vec *out) {
+	return tree_query(t, p, false, out);
+}
+
+bool aabb_tree_query_rect(const struct aabb_tree *t, const float r[static 4],
+		struct vec *out) {
+	return tree_query(t, r, true, out);
+}
+
+/*
+ * Best-first search: nodes and boxes share one heap ordered by distance, and
+ * since a node is never farther than its entries, the boxes come out of it
+ * in order. Boxes are stored as ~index to tell them apart from nodes.
+ */
+bool aabb_tree_nearest(const struct aabb_tree *t, const float p[static 2],
+		int k, struct vec *out) {
+	if (t->nodes.len == 0 || k <= 0) return true;
+	const struct node *nodes = t->nodes.d;
+	struct vec heap = vec_new_with_alloc(sizeof(struct cand), out->alloc);
+	bool ok = heap_push(&heap, (struct cand){ 0, t->nodes.len - 1 });
+	while (ok && heap.len > 0 && k > 0) {
+		struct cand c = heap_pop(&heap);
+		if (c.i < 0) {
+			int idx = ~c.i;
+			ok = vec_append(out, &idx) >= 0;
+			--k;
+			continue;
+		}
+		const struct node *nd = &nodes[c.i];
+		bool leaf = c.i < t->leaves;
+		for (int j = 0; ok && j < nd->n; ++j) {
+			float d = dist2(nd->min_x[j], nd->min_y[j],
+				nd->max_x[j], nd->max_y[j], p);
+			int i = leaf ? ~nd->idx[j] : nd->idx[j];
+			ok = heap_push(&heap, (struct cand){ d, i });
+		}
+	}
+	vec_free(&heap);
+	return ok;
+}
+
+/*
+ * Grid. The cells of a box are a rectangular range of cells, and a box that
+ * overlaps several of them is reported only from the first cell of the range
+ * it shares with the query, so no duplicates are reported.
+ */
+
+struct entry {
+	float box[4];
+	bool used;
+};
+
+struct range {
+	int x0, y0, x1, y1;
+};
+
+static const struct range range_empty = { 0, 0, -1, -1 };
+
+static bool in_range(const struct range *r, int x, int y) {
+	return x >= r->x0 && x <= r->x1 && y >= r->y0 && y <= r->y1;
+}
+
+static int cell_of(const struct aabb_grid *g, float v, int j) {
+	const int count = j == 0 ? g->cols : g->rows;
+	float f = floorf((v - g->bounds[j]) / g->cell);
+	if (!(f >= 0)) return 0;
+	return f < count - 1 ? (int)f : count - 1;
+}
+
+/* Every box gets at least one cell, even empty ones, for the nearest
+ * queries. */
+static struct range range_of(const struct aabb_grid *g,
+		const float b[static 4]) {
+	struct range r = {
+		cell_of(g, b[0], 0), cell_of(g, b[1], 1),
+		cell_of(g, b[0] + b[2], 0), cell_of(g, b[1] + b[3], 1),
+	};
+	if (r.x1 < r.x0) r.x1 = r.x0;
+	if (r.y1 < r.y0) r.y1 = r.y0;
+	return r;
+}
+
+static struct vec *cell_at(struct aabb_grid *g, int x, int y) {
+	return vec_get(&g->cells, y * g->cols + x);
+}
+
+static const struct vec *cell_c(const struct aabb_grid *g, int x, int y) {
+	return vec_get_c(&g->cells, y * g->cols + x);
+}
+
+static void cell_remove(struct vec *c, int id) {
+	const int *ids = c->d;
+	for (int i = 0; i < c->len; ++i) {
+		if (ids[i] == id) {
+			vec_swap_remove(c, i);
+			return;
+		}
+	}
+}
+
+/* Removes id from the cells of r that are not in skip. */
+static void cells_remove(struct aabb_grid *g, int id, const struct range *r,
+		const struct range *skip) {
+	for (int y = r->y0; y <= r->y1; ++y) {
+		for (int x = r->x0; x <= r->x1; ++x) {
+			if (in_range(skip, x, y)) continue;
+			cell_remove(cell_at(g, x, y), id);
+		}
+	}
+}
+
+/* Adds id to the cells of r that are not in skip, all or nothing. */
+static bool cells_add(struct aabb_grid *g, int id, const struct range *r,
+		const struct range *skip) {
+	for (int y = r->y0; y <= r->y1; ++y) {
+		for (int x = r->x0; x <= r->x1; ++x) {
+			if (in_range(skip, x, y)) continue;
+			if (vec_append(cell_at(g, x, y), &id) >= 0) continue;
+
+			/* undo the cells before (x, y) */
+			struct range done = { r->x0, r->y0, r->x1, y - 1 };
+			cells_remove(g, id, &done, skip);
+			done = (struct range){ r->x0, y, x - 1, y };
+			cells_remove(g, id, &done, skip);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool aabb_grid_init(struct aabb_grid *g, const float bounds[static 4],
+		float cell, const struct allocator *alloc) {
+	asrt(cell > 0, "bad grid cell size");
+	asrt(bounds[2] >= 0 && bounds[3] >= 0, "bad grid bounds");
+	/* checked as floats, the conversion of a larger value is undefined */
+	float cols = fmaxf(ceilf(bounds[2] / cell), 1);
+	float rows = fmaxf(ceilf(bounds[3] / cell), 1);
+	if (!(cols < (float)INT_MAX && rows < (float)INT_MAX)) return false;
+	int n;
+	if (__builtin_mul_overflow((int)cols, (int)rows, &n)) return false;
+
+	memcpy(g->bounds, bounds, sizeof(g->bounds));
+	g->cell = cell;
+	g->cols = cols;
+	g->rows = rows;
+	g->cells = vec_new_with_alloc(sizeof(struct vec), alloc);
+	g->entries = vec_new_with_alloc(sizeof(struct entry), alloc);
+	g->free_ids = vec_new_with_alloc(sizeof(int), alloc);
+	if (!vec_reserve(&g->cells, n)) return false;
+	g->cells.len = n;
+	for (int i = 0; i < g->cells.len; ++i) {
+		*(struct vec *)vec_get(&g->cells, i) =
+			vec_new_with_alloc(sizeof(int), alloc);
+	}
+	return true;
+}
+
+void aabb_grid_finish(struct aabb_grid *g) {
+	for (int i = 0; i < g->cells.len; ++i) {
+		vec_free(vec_get(&g->cells, i));
+	}
+	vec_free(&g->cells);
+	vec_free(&g->entries);
+	vec_free(&g->free_ids);
+}
+
+int aabb_grid_insert(struct aabb_grid *g, const float box[static 4]) {
+	int id;
+	bool reused = g->free_ids.len > 0;
+	if (reused) {
+		id = ((int *)g->free_ids.d)[--g->free_ids.len];
+	} else {
+		id = vec_append(&g->entries, &(struct entry){ .used = false });
+		if (id < 0) return -1;
+	}
+
+	struct range r = range_of(g, box);
+	if (!cells_add(g, id, &r, &range_empty)) {
+		/* the id was just taken from the free list, so there is room */
+		if (reused) vec_append(&g->free_ids, &id);
+		else --g->entries.len;
+		return -1;
+	}
+	struct entry *e = vec_get(&g->entries, id);
+	memcpy(e->box, box, sizeof(e->box));
+	e->used = true;
+	return id;
+}
+
+void aabb_grid_remove(struct aabb_grid *g, int id) {
+	struct entry *e = vec_get(&g->entries, id);
+	asrt(e->used, "bad grid id");
+	struct range r = range_of(g, e->box);
+	cells_remove(g, id, &r, &range_empty);
+	e->used = false;
+	/* if this fails, the id is just not reused */
+	vec_append(&g->free_ids, &id);
+}
+
+bool aabb_grid_move(struct aabb_grid *g, int id, const float box[static 4]) {
+	struct entry *e = vec_get(&g->entries, id);
+	asrt(e->used, "bad grid id");
+	struct range old = range_of(g, e->box), new = range_of(g, box);
+	if (!cells_add(g, id, &new, &old)) return false;
+	cells_remove(g, id, &old, &new);
+	memcpy(e->box, box, sizeof(e->box));
+	return true;
+}
+
+static const struct entry *entry_c(const struct aabb_grid *g, int id) {
+	return vec_get_c(&g->entries, id);
+}
+
+bool aabb_grid_query_point(const struct aabb_grid *g, const float p[static 2],
+		struct vec *out) {
+	const struct vec *c =
+		cell_c(g, cell_of(g, p[0], 0), cell_of(g, p[1], 1));
+	const int *ids = c->d;
+	for (int i = 0; i < c->len; ++i) {
+		if (!aabb_contains(entry_c(g, ids[i])->box, p)) continue;
+		if (vec_append(out, &ids[i]) < 0) return false;
+	}
+	return true;
+}
+
+static int maxi(int a, int b) { return a > b ? a : b; }
+
+bool aabb_grid_query_rect(const struct aabb_grid *g, const float r[static 4],
+		struct vec *out) {
+	const struct range q = range_of(g, r);
+	for (int y = q.y0; y <= q.y1; ++y) {
+		for (int x = q.x0; x <= q.x1; ++x) {
+			const struct vec *c = cell_c(g, x, y);
+			const int *ids = c->d;
+			for (int i = 0; i < c->len; ++i) {
+				const float *b = entry_c(g, ids[i])->box;
+				struct range br = range_of(g, b);
+				if (x != maxi(br.x0, q.x0)
+						|| y != maxi(br.y0, q.y0)) {
+					continue;
+				}
+				float is[4];
+				aabb_intersect(is, b, r);
+				if (!(is[2] > 0 && is[3] > 0)) continue;
+				if (vec_append(out, &ids[i]) < 0) return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* Offers the boxes of c to the k best in heap (a min-heap on -d). */
+static bool nearest_cell(const struct aabb_grid *g, const struct vec *c,
+		const float p[static 2], int k, struct vec *heap) {
+	const int *ids = c->d;
+	for (int i = 0; i < c->len; ++i) {
+		const float *b = entry_c(g, ids[i])->box;
+		float d = dist2(b[0], b[1], b[0] + b[2], b[1] + b[3], p);
+		const struct cand *h = heap->d;
+		if (heap->len == k && d >= -h[0].d) continue;
+		bool seen = false;
+		for (int j = 0; j < heap->len; ++j) seen |= h[j].i == ids[i];
+		if (seen) continue;
+		if (heap->len == k) heap_pop(heap);
+		if (!heap_push(heap, (struct cand){ -d, ids[i] })) return false;
+	}
+	return true;
+}
+
+/*
+ * Scans the cells in square rings around the cell of p, keeping the k best
+ * boxes in a max-heap (a min-heap on -d). A box not seen yet lies outside of
+ * the square of the rings scanned so far, so it is at least as far as the
+ * border of that square. One ring of slack is left for the rounding in
+ * cell_of. Boxes listed in several cells are only taken once.
+ */
+bool aabb_grid_nearest(const struct aabb_grid *g, const float p[static 2],
+		int k, struct vec *out) {
+	if (k <= 0) return true;
+	const int px = cell_of(g, p[0], 0), py = cell_of(g, p[1], 1);
+	const int last = maxi(maxi(px, g->cols - 1 - px),
+		maxi(py, g->rows - 1 - py));
+	struct vec heap = vec_new_with_alloc(sizeof(struct cand), out->alloc);
+	bool ok = true;
+	for (int r = 0; ok && r <= last; ++r) {
+		for (int y = py - r; ok && y <= py + r; ++y) {
+			if (y < 0 || y >= g->rows) continue;
+			int step = y == py - r || y == py + r ? 1 : 2 * r;
+			for (int x = px - r; ok && x <= px + r; x += step) {
+				if (x < 0 || x >= g->cols) continue;
+				ok = nearest_cell(g, cell_c(g, x, y), p, k,
+					&heap);
+			}
+		}
+
+		if (!ok || heap.len < k || r == 0) continue;
+		const float *bo = g->bounds;
+		float x0 = bo[0] + (px - r + 1) * g->cell;
+		float x1 = bo[0] + (px + r) * g->cell;
+		float y0 = bo[1] + (py - r + 1) * g->cell;
+		float y1 = bo[1] + (py + r) * g->cell;
+		float border = fminf(fminf(p[0] - x0, x1 - p[0]),
+			fminf(p[1] - y0, y1 - p[1]));
+		const struct cand *h = heap.d;
+		if (border > 0 && border * border >= -h[0].d) break;
+	}
+
+	if (ok && (ok = vec_grow(out, heap.len))) {
+		int *o = (int *)out->d + out->len;
+		out->len += heap.len;
+		for (int i = heap.len - 1; i >= 0; --i) {
+			o[i] = heap_pop(&heap).i;
+		}
+	}
+	vec_free(&heap);
+	return ok;
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <ds/vec.h>
+#include "core.h"
+
+struct str_builder_block {
+	struct str_builder_block *next;
+	size_t len, cap;
+	char d[];
+};
+
+/* number of blocks passed to a single writev call */
+#define WRITEV_BATCH 64
+
+struct str_builder str_builder_new(const struct allocator *alloc) {
+	return (struct str_builder){
+		.head = NULL, .tail = NULL, .len = 0, .alloc = alloc };
+}
+
+bool str_builder_append(struct str_builder *b, const char *n, size_t l) {
+	struct str_builder_block *t = b->tail;
+	size_t k = t ? (t->cap - t->len < l ? t->cap - t->len : l) : 0;
+
+	/* allocate before copying anything, so a failed append changes
+	 * nothing; big appends get a block of their own size */
+	struct str_builder_block *nb = NULL;
+	if (l > k) {
+		size_t cap = l - k > STR_BUILDER_BLOCK
+			? l - k : STR_BUILDER_BLOCK;
+		nb = allocator_alloc(b->alloc, sizeof(*nb) + cap);
+		if (!nb) return false;
+		nb->next = NULL;
+		nb->cap = cap;
+		nb->len = l - k;
+		memcpy(nb->d, n + k, l - k);
+	}
+
+	if (k > 0) {
+		memcpy(t->d + t->len, n, k);
+		t->len += k;
+	}
+	if (nb) {
+		if (t) t->next = nb;
+		else b->head = nb;
+		b->tail = nb;
+	}
+	b->len += l;
+	return true;
+}
+
+size_t str_builder_len(const struct str_builder *b) {
+	return b->len;
+}
+
+bool str_builder_write(const struct str_builder *b, int fd) {
+	struct iovec iov[WRITEV_BATCH];
+	const struct str_builder_block *x = b->head;
+	while (x) {
+		int n = 0;
+		for (; x && n < WRITEV_BATCH; x = x->next) {
+			if (x->len == 0) continue;
+			iov[n++] = (struct iovec){
+				.iov_base = (void *)x->d, .iov_len = x->len };
+		}
+
+		struct iovec *v = iov;
+		while (n > 0) {
+			ssize_t w = writev(fd, v, n);
+			if (w < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			/* skip what was written, a block may be partial */
+			while (n > 0 && (size_t)w >= v->iov_len) {
+				w -= v->iov_len;
+				++v;
+				--n;
+			}
+			if (n > 0) {
+				v->iov_base = (char *)v->iov_base + w;
+				v->iov_len -= w;
+			}
+		}
+	}
+	return true;
+}
+
+bool str_builder_flatten(const struct str_builder *b, struct str *out) {
+	*out = str_new_with_alloc(b->alloc);
+	if (b->len > INT_MAX - 1) return false;
+	if (!str_reserve(out, b->len)) return false;
+	for (const struct str_builder_block *x = b->head; x; x = x->next) {
+		bool ok = str_append(out, x->d, x->len);
+		asrt(ok, "str_reserve went wrong");
+	}
+	return true;
+}
+
+void str_builder_free(struct str_builder *b) {
+	struct str_builder_block *x = b->head;
+	while (x) {
+		struct str_builder_block *next = x->next;
+		allocator_free(b->alloc, x, sizeof(*x) + x->cap);
+		x = next;
+	}
+	*b = str_builder_new(b->alloc);
+}
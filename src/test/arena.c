@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/arena.h>
+#include <ds/vec.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+static void test_alloc() {
+	struct arena a;
+	arena_init(&a, 1024);
+
+	char *p[100];
+	for (int i = 0; i < 100; ++i) {
+		p[i] = arena_alloc(&a, i + 1);
+		asrt(p[i], "arena_alloc");
+		asrt((uintptr_t)p[i] % alignof(max_align_t) == 0, "alignment");
+		memset(p[i], i, i + 1);
+	}
+	for (int i = 0; i < 100; ++i) {
+		for (int j = 0; j <= i; ++j) asrt(p[i][j] == i, "content");
+	}
+
+	/* bigger than a chunk */
+	char *big = arena_alloc(&a, 10000);
+	asrt(big, "big alloc");
+	memset(big, 0xff, 10000);
+
+	arena_finish(&a);
+}
+
+static void test_rewind() {
+	struct arena a;
+	arena_init(&a, 256);
+
+	char *first = arena_alloc(&a, 16);
+	struct arena_mark m = arena_mark(&a);
+	char *q = arena_alloc(&a, 16);
+	for (int i = 0; i < 100; ++i) asrt(arena_alloc(&a, 100), "");
+	arena_rewind(&a, m);
+	asrt(arena_alloc(&a, 16) == q, "rewind reuses memory");
+	asrt(first != q, "");
+
+	/* rewinding to the mark of an empty arena frees everything */
+	struct arena b;
+	arena_init(&b, 0);
+	struct arena_mark empty = arena_mark(&b);
+	for (int i = 0; i < 10; ++i) asrt(arena_alloc(&b, 100000), "");
+	arena_rewind(&b, empty);
+	asrt(b.chunk == NULL, "empty");
+
+	arena_finish(&a);
+	arena_finish(&b);
+}
+
+static void test_containers() {
+	struct arena a;
+	arena_init(&a, 1 << 16);
+
+	/* the last allocation grows in place */
+	struct vec v = vec_new_with_alloc(sizeof(int), &a.alloc);
+	int x = 0;
+	vec_append(&v, &x);
+	void *d = v.d;
+	for (int i = 1; i < 1000; ++i) asrt(vec_append(&v, &i) == i, "");
+	asrt(v.d == d, "in place growth");
+	for (int i = 0; i < 1000; ++i) {
+		asrt(*(int *)vec_get(&v, i) == i, "vec content");
+	}
+
+	/* it no longer is, so w moves, but keeps its content */
+	struct vec w = vec_new_with_alloc(sizeof(int), &a.alloc);
+	vec_append(&w, &x);
+	for (int i = 1; i < 100; ++i) vec_append(&v, &i);
+	asrt(v.d != d, "moved");
+	for (int i = 0; i < 1099; ++i) {
+		asrt(*(int *)vec_get(&v, i) == (i < 1000 ? i : i - 999),
+			"moved content");
+	}
+
+	/* growing past the chunk */
+	struct str s = str_new_with_alloc(&a.alloc);
+	for (int i = 0; i < 20000; ++i) asrt(str_append(&s, "abcd", 4), "");
+	asrt(str_len(&s) == 80000, "str_len");
+	asrt(strncmp(str_cstr(&s) + 79996, "abcd", 5) == 0, "str content");
+
+	vec_free(&w);
+	str_free(&s);
+	vec_free(&v);
+	arena_finish(&a);
+
+	/* freeing the last allocation gives the space back */
+	struct arena b;
+	arena_init(&b, 0);
+	asrt(arena_alloc(&b, 10), "");
+	struct arena_mark m = arena_mark(&b);
+	struct vec u = vec_new_with_alloc(sizeof(int), &b.alloc);
+	for (int i = 0; i < 100; ++i) vec_append(&u, &i);
+	vec_free(&u);
+	struct arena_mark m2 = arena_mark(&b);
+	asrt(m.chunk == m2.chunk && m.used == m2.used, "free last");
+	arena_finish(&b);
+}
+
+static void *thread_fn(void *arg) {
+	struct arena *a = arena_thread();
+	asrt(a == arena_thread(), "same arena in a thread");
+	asrt(arena_alloc(a, 100), "");
+	*(struct arena **)arg = a;
+	arena_finish(a);
+	return NULL;
+}
+
+static void test_thread() {
+	struct arena *mine = arena_thread(), *other;
+	pthread_t t;
+	asrt(pthread_create(&t, NULL, thread_fn, &other) == 0, "");
+	pthread_join(t, NULL);
+	asrt(mine != other, "thread local");
+	arena_finish(mine);
+}
+
+int main() {
+	test_alloc();
+	test_rewind();
+	test_containers();
+	test_thread();
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
+#include "../core.h"
+#include <ds/deque.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+static void check(struct deque *q, const int *model, int lo, int hi) {
+	asrt(deque_len(q) == hi - lo, "len");
+	for (int i = lo; i < hi; ++i) {
+		asrt(*(int *)deque_get(q, i - lo) == model[i], "content");
+	}
+}
+
+static void test_deque() {
+	/* model: a large array, with the deque being [lo, hi) */
+	enum { N = 1 << 16 };
+	static int model[2 * N];
+	int lo = N, hi = N;
+	struct deque q = deque_new(sizeof(int), NULL);
+
+	srand(1);
+	for (int it = 0; it < 20000; ++it) {
+		int x = rand();
+		switch (rand() % 6) {
+		case 0:
+		case 1:
+			asrt(deque_push_back(&q, &x), "");
+			model[hi++] = x;
+			break;
+		case 2:
+			asrt(deque_push_front(&q, &x), "");
+			model[--lo] = x;
+			break;
+		case 3: {
+			int y;
+			bool ok = deque_pop_front(&q, &y);
+			asrt(ok == (lo < hi), "pop_front on empty");
+			if (ok) asrt(y == model[lo++], "pop_front");
+			break;
+		}
+		case 4: {
+			int y;
+			bool ok = deque_pop_back(&q, &y);
+			asrt(ok == (lo < hi), "pop_back on empty");
+			if (ok) asrt(y == model[--hi], "pop_back");
+			break;
+		}
+		case 5: {
+			int buf[37];
+			int l = rand() % 37;
+			if (rand() % 2) {
+				for (int i = 0; i < l; ++i) buf[i] = rand();
+				asrt(deque_push_back_multiple(&q, buf, l), "");
+				for (int i = 0; i < l; ++i) model[hi++] = buf[i];
+			} else {
+				int r = deque_pop_front_multiple(&q, buf, l);
+				asrt(r == (l < hi - lo ? l : hi - lo), "pop count");
+				for (int i = 0; i < r; ++i) {
+					asrt(buf[i] == model[lo++], "pop multiple");
+				}
+			}
+			break;
+		}
+		}
+		asrt(lo > 0 && hi < 2 * N, "model too small");
+		if (it % 97 == 0) check(&q, model, lo, hi);
+	}
+	check(&q, model, lo, hi);
+	asrt((q.v.cap & (q.v.cap - 1)) == 0, "power of two cap");
+
+	deque_clear(&q);
+	asrt(deque_len(&q) == 0 && !deque_pop_back(&q, NULL), "clear");
+	deque_free(&q);
+}
+
+enum { SPSC_N = 1000000 };
+
+static void *producer(void *arg) {
+	struct spsc_ring *r = arg;
+	int i = 0;
+	while (i < SPSC_N) {
+		if (i % 3 == 0) {
+			int buf[16];
+			int l = SPSC_N - i < 16 ? SPSC_N - i : 16;
+			for (int j = 0; j < l; ++j) buf[j] = i + j;
+			int pushed = spsc_ring_push_multiple(r, buf, l);
+			if (pushed == 0) sched_yield();
+			i += pushed;
+		} else if (spsc_ring_push(r, &i)) {
+			++i;
+		} else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void test_spsc() {
+	struct spsc_ring r;
+	asrt(spsc_ring_init(&r, sizeof(int), 100, NULL), "init");
+	asrt(r.mask + 1 == 128, "cap rounded up");
+
+	/* single threaded: full and empty */
+	for (int i = 0; i < 128; ++i) asrt(spsc_ring_push(&r, &i), "push");
+	int x = -1;
+	asrt(!spsc_ring_push(&r, &x), "full");
+	for (int i = 0; i < 128; ++i) {
+		asrt(spsc_ring_pop(&r, &x) && x == i, "pop");
+	}
+	asrt(!spsc_ring_pop(&r, &x), "empty");
+
+	pthread_t t;
+	asrt(pthread_create(&t, NULL, producer, &r) == 0, "");
+	int next = 0;
+	while (next < SPSC_N) {
+		int buf[10];
+		int l = spsc_ring_pop_multiple(&r, buf, 10);
+		if (l == 0) sched_yield();
+		for (int j = 0; j < l; ++j) asrt(buf[j] == next++, "order");
+	}
+	pthread_join(t, NULL);
+	asrt(!spsc_ring_pop(&r, &x), "empty at the end");
+	spsc_ring_finish(&r);
+}
+
+int main() {
+	test_deque();
+	test_spsc();
+}
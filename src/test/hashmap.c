@@ -35,6 +35,44 @@ void test_prefix_keys(uint8_t *key, int n) {
 	hashmap_finish(&m);
 }
 
+static int n_alloc, n_free;
+static void *c_alloc(void *ctx, size_t size) {
+	++n_alloc;
+	return malloc(size);
+}
+static void *c_realloc(void *ctx, void *ptr, size_t old_size,
+		size_t new_size) {
+	return realloc(ptr, new_size);
+}
+static void c_free(void *ctx, void *ptr, size_t size) {
+	++n_free;
+	free(ptr);
+}
+
+static void test_alloc() {
+	struct allocator a = {
+		.alloc = c_alloc, .realloc = c_realloc, .free = c_free
+	};
+	struct hashmap m;
+	hashmap_init_with_alloc(&m, sizeof(uint32_t), &a);
+
+	/* enough keys for a few rehashes */
+	uint32_t keys[2000];
+	for (uint32_t i = 0; i < 2000; ++i) {
+		keys[i] = i;
+		asrt(hashmap_put_u32(&m, &keys[i], &i) == MAP_OK, "put");
+	}
+	for (uint32_t i = 0; i < 2000; ++i) {
+		uint32_t *data;
+		asrt(hashmap_get_u32(&m, &keys[i], (void **)&data) == MAP_OK,
+			"get");
+		asrt(*data == i, "data");
+	}
+	hashmap_finish(&m);
+
+	asrt(n_alloc > 1 && n_alloc == n_free, "alloc/free pairs");
+}
+
 int main() {
 	uint8_t key_zero[128] = { 0 };
 	test_prefix_keys(key_zero, 128);
@@ -42,4 +80,6 @@ int main() {
 	uint8_t key_lin[128];
 	for (int i = 0; i < 128; ++i) key_lin[i] = i;
 	test_prefix_keys(key_lin, 128);
+
+	test_alloc();
 }
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/intern.h>
+#include <stdio.h>
+#include <string.h>
+
+static void test_intern() {
+	struct intern in;
+	intern_init(&in);
+
+	/* enough strings to fill several chunks and rehash the map */
+	char buf[64];
+	for (int round = 0; round < 2; ++round) {
+		for (int i = 0; i < 5000; ++i) {
+			int l = snprintf(buf, sizeof(buf), "key-%d", i);
+			int atom = intern_slice(&in,
+				(struct str_slice){ .d = buf, .len = l });
+			asrt(atom == i, "atoms are dense and stable");
+		}
+	}
+	asrt(intern_count(&in) == 5000, "count");
+
+	for (int i = 0; i < 5000; ++i) {
+		snprintf(buf, sizeof(buf), "key-%d", i);
+		struct str_slice s = intern_get(&in, i);
+		asrt(strcmp(s.d, buf) == 0 && s.len == strlen(buf), "get");
+		asrt(intern_find(&in, s) == i, "find");
+		asrt(intern_get(&in, intern_cstr(&in, buf)).d == s.d,
+			"canonical pointer");
+	}
+	asrt(intern_find(&in, (struct str_slice){ .d = "nope", .len = 4 })
+		== -1, "find missing");
+
+	/* the empty string, prefixes and a string longer than a chunk */
+	int e = intern_cstr(&in, "");
+	asrt(intern_get(&in, e).len == 0, "empty");
+	asrt(intern_find(&in, (struct str_slice){ .d = "key-1", .len = 4 })
+		!= intern_cstr(&in, "key-1"), "prefix");
+	static char big[40000];
+	memset(big, 'x', sizeof(big));
+	int b = intern_slice(&in,
+		(struct str_slice){ .d = big, .len = sizeof(big) });
+	asrt(b == intern_slice(&in,
+		(struct str_slice){ .d = big, .len = sizeof(big) }), "big");
+	asrt(intern_get(&in, b).len == sizeof(big), "big len");
+
+	intern_finish(&in);
+}
+
+int main() {
+	test_intern();
+}
@@ -1,7 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
 #include "../core.h"
 #include <ds/iter.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static void test_str_gen_split(const char *str, char c,
 		const char *res[], int len) {
@@ -18,6 +23,466 @@ static void test_str_gen_split(const char *str, char c,
 		++i;
 	}
 	asrt(i == len, "");
+
+	/* the bulk mode gives the same pieces, for any batch size */
+	for (int n = 1; n <= 4; ++n) {
+		g = str_gen_split((struct str_slice){
+			.d = str, .len = strlen(str) }, c);
+		struct str_slice out[4];
+		int k;
+		i = 0;
+		while ((k = str_gen_split_bulk(&g, out, n)) > 0) {
+			asrt(k <= n, "bulk count");
+			for (int j = 0; j < k; ++j, ++i) {
+				asrt(i < len, "bulk too long");
+				asrt(strlen(res[i]) == out[j].len, "bulk len");
+				asrt(strncmp(res[i], out[j].d, out[j].len) == 0,
+					"bulk content");
+			}
+		}
+		asrt(i == len, "bulk too short");
+		asrt(!str_gen_next(&g, &s), "bulk done");
+	}
+}
+
+/* long inputs, crossing the 64 byte blocks of the bulk mode */
+static void test_split_long() {
+	static char buf[5000];
+	static struct str_slice out[5000];
+	srand(1);
+	for (int it = 0; it < 50; ++it) {
+		int len = rand() % sizeof(buf);
+		int density = 1 + rand() % 100;
+		for (int i = 0; i < len; ++i) {
+			buf[i] = rand() % density == 0
+				? '\n' : 'a' + rand() % 26;
+		}
+		struct str_slice str = { .d = buf, .len = len };
+
+		struct str_gen g = str_gen_split(str, '\n');
+		int k = 0, n = 1 + rand() % 70, r;
+		while ((r = str_gen_split_bulk(&g, out + k, n)) > 0) k += r;
+
+		g = str_gen_split(str, '\n');
+		int from = 0, i = 0;
+		for (int j = 0; j <= len; ++j) {
+			if (j < len && buf[j] != '\n') continue;
+			struct str_slice s;
+			asrt(str_gen_next(&g, &s), "next");
+			asrt(s.d == buf + from && s.len == j - from,
+				"next piece");
+			asrt(i < k, "bulk too short");
+			asrt(out[i].d == s.d && out[i].len == s.len,
+				"bulk piece");
+			++i;
+			from = j + 1;
+		}
+		asrt(i == k, "bulk too long");
+		struct str_slice s;
+		asrt(!str_gen_next(&g, &s), "next too long");
+	}
+}
+
+/* res lists the unescaped fields, with NULL after the last one of a record */
+static void test_csv(const char *str, char sep, const char *res[], int len) {
+	struct str_gen g = str_gen_csv((struct str_slice){
+		.d = str, .len = strlen(str) }, sep);
+
+	int i = 0;
+	struct str_slice s;
+	char buf[64];
+	while (str_gen_next(&g, &s)) {
+		asrt(i < len && res[i], "csv too many fields");
+		int l = s.len;
+		if (str_gen_csv_escaped(&g)) {
+			l = str_csv_unescape(s, buf);
+		} else {
+			memcpy(buf, s.d, l);
+			asrt(s.d >= str && s.d + s.len <= str + strlen(str),
+				"csv slice outside the input");
+		}
+		asrt(strlen(res[i]) == l && strncmp(res[i], buf, l) == 0,
+			"csv field");
+		++i;
+		if (str_gen_csv_end_of_record(&g)) {
+			asrt(i < len && !res[i], "csv record too long");
+			++i;
+		} else {
+			asrt(i < len && res[i], "csv record too short");
+		}
+	}
+	asrt(i == len, "csv too few fields");
+}
+
+static void test_csv_all() {
+	test_csv("", ',', NULL, 0);
+	test_csv("a,b,c", ',', (const char *[]){ "a", "b", "c", NULL }, 4);
+	test_csv("a,b\nc,d\n", ',',
+		(const char *[]){ "a", "b", NULL, "c", "d", NULL }, 6);
+	test_csv("a,\r\n,b\r\n\n", ',',
+		(const char *[]){ "a", "", NULL, "", "b", NULL, "", NULL }, 8);
+	test_csv("\"x,y\",\"say \"\"hi\"\"\"\n\"\"", ',',
+		(const char *[]){ "x,y", "say \"hi\"", NULL, "", NULL }, 5);
+	test_csv("\"multi\nline\"\t2\n", '\t',
+		(const char *[]){ "multi\nline", "2", NULL }, 3);
+	test_csv("a\tb,c\td", '\t',
+		(const char *[]){ "a", "b,c", "d", NULL }, 4);
+	/* malformed: unterminated quote, text after the closing quote */
+	test_csv("\"ab\"cd,e\n\"open,f", ',',
+		(const char *[]){ "ab", "e", NULL, "open,f", NULL }, 5);
+	/* long fields go through the vectorized scan */
+	test_csv("0123456789abcdef0123456789abcdef,0123456789abcdef0123456789\n"
+		"x", ',', (const char *[]){
+			"0123456789abcdef0123456789abcdef",
+			"0123456789abcdef0123456789", NULL, "x", NULL }, 5);
+}
+
+/* the streaming kinds give the same pieces as splitting the whole buffer */
+static void check_stream(struct str_gen *g, const char *buf, int len) {
+	struct str_gen ref = str_gen_split((struct str_slice){
+		.d = buf, .len = len }, '\n');
+	struct str_slice a, b;
+	while (str_gen_next(&ref, &a)) {
+		asrt(str_gen_next(g, &b), "stream too short");
+		asrt(a.len == b.len, "stream piece len");
+		asrt(a.len == 0 || memcmp(a.d, b.d, a.len) == 0,
+			"stream piece");
+	}
+	asrt(!str_gen_next(g, &b), "stream too long");
+	str_gen_finish(g);
+}
+
+static void test_split_stream() {
+	const char *path = "test_iter_split_stream.txt";
+	static char buf[100000];
+	srand(2);
+	for (int it = 0; it < 20; ++it) {
+		int len = it == 0 ? 0 : rand() % sizeof(buf);
+		/* some pieces are longer than the chunks */
+		int density = 1 + rand() % (it % 2 ? 10 : 5000);
+		for (int i = 0; i < len; ++i) {
+			buf[i] = rand() % density == 0
+				? '\n' : 'a' + rand() % 26;
+		}
+		FILE *f = fopen(path, "wb");
+		asrt(f && fwrite(buf, 1, len, f) == len && fclose(f) == 0,
+			"write");
+
+		struct str_gen g;
+		int fd = open(path, O_RDONLY);
+		asrt(fd >= 0, "open");
+		asrt(str_gen_split_fd(&g, fd, '\n', 1 + rand() % 1000), "");
+		check_stream(&g, buf, len);
+		asrt(!g.split_fd.error, "read error");
+		close(fd);
+
+		asrt(str_gen_split_mmap(&g, path, '\n'), "mmap");
+		check_stream(&g, buf, len);
+	}
+	remove(path);
+}
+
+static void count_pieces(void *env, int chunk, struct str_gen *g) {
+	int *counts = env;
+	struct str_slice s;
+	while (str_gen_next(g, &s)) ++counts[chunk];
+}
+
+static void test_split_parallel() {
+	int len = 3 << 20;
+	char *buf = malloc(len);
+	asrt(buf, "");
+	srand(3);
+	for (int it = 0; it < 4; ++it) {
+		for (int i = 0; i < len; ++i) {
+			switch (it) {
+			case 0: buf[i] = rand() % 50 ? 'x' : ','; break;
+			case 1: buf[i] = ','; break; /* only empty pieces */
+			case 2: buf[i] = 'x'; break; /* a single piece */
+			case 3: buf[i] = i == len - 1 ? ',' : 'x'; break;
+			}
+		}
+		struct str_slice str = { .d = buf, .len = len };
+
+		struct vec v = vec_new_empty(sizeof(struct str_slice));
+		asrt(str_split_parallel(buf, len, ',', 4, &v), "parallel");
+		struct str_gen g = str_gen_split(str, ',');
+		struct str_slice s;
+		int i = 0;
+		while (str_gen_next(&g, &s)) {
+			asrt(i < v.len, "parallel too short");
+			struct str_slice *p = vec_get(&v, i++);
+			asrt(p->d == s.d && p->len == s.len, "parallel piece");
+		}
+		asrt(i == v.len, "parallel too long");
+
+		g = str_gen_split_mem(buf, len, ',');
+		for (i = 0; str_gen_next(&g, &s); ++i) {
+			struct str_slice *p = vec_get(&v, i);
+			asrt(p->d == s.d && p->len == s.len, "split_mem piece");
+		}
+		asrt(i == v.len, "split_mem count");
+
+		int counts[64] = { 0 };
+		int n = str_split_parallel_each(buf, len, ',', 4,
+			count_pieces, counts);
+		asrt(n >= 1 && n <= 4, "chunk count");
+		int total = 0;
+		for (int j = 0; j < n; ++j) total += counts[j];
+		asrt(total == v.len, "callback pieces");
+		vec_free(&v);
+	}
+	free(buf);
+
+	/* small inputs are split on the calling thread */
+	struct vec v = vec_new_empty(sizeof(struct str_slice));
+	asrt(str_split_parallel("a,,b", 4, ',', 8, &v), "");
+	asrt(v.len == 3, "small input");
+	/* appending after existing pieces */
+	asrt(str_split_parallel("c,d", 3, ',', 8, &v), "");
+	struct str_slice *p = v.d;
+	asrt(v.len == 5 && p[3].len == 1 && p[3].d[0] == 'c'
+		&& p[4].len == 1 && p[4].d[0] == 'd', "append");
+	vec_free(&v);
+}
+
+static void expect(struct str_gen *g, const char *res[], int len) {
+	struct str_slice s;
+	int i = 0;
+	while (str_gen_next(g, &s)) {
+		asrt(i < len, "pipeline too long");
+		asrt(strlen(res[i]) == s.len
+			&& strncmp(res[i], s.d, s.len) == 0, "pipeline piece");
+		++i;
+	}
+	asrt(i == len, "pipeline too short");
+}
+
+static void test_pipeline() {
+	const char *text = "  a b , c\n\n x,  ,y  \n\t\n z ";
+	struct str_slice str = { .d = text, .len = strlen(text) };
+
+	struct str_gen lines = str_gen_split(str, '\n');
+	struct str_gen trimmed = str_gen_trim(&lines);
+	struct str_gen rows = str_gen_nonempty(&trimmed);
+	expect(&rows, (const char *[]){ "a b , c", "x,  ,y", "z" }, 3);
+
+	lines = str_gen_split(str, '\n');
+	trimmed = str_gen_trim(&lines);
+	rows = str_gen_nonempty(&trimmed);
+	struct str_gen fields = str_gen_split_each(&rows, ',');
+	struct str_gen tf = str_gen_trim(&fields);
+	expect(&tf, (const char *[]){ "a b", "c", "x", "", "y", "z" }, 6);
+
+	lines = str_gen_split(str, '\n');
+	struct str_gen skip = str_gen_skip(&lines, 1);
+	struct str_gen take = str_gen_take(&skip, 2);
+	expect(&take, (const char *[]){ "", " x,  ,y  " }, 2);
+
+	lines = str_gen_split(str, '\n');
+	skip = str_gen_skip(&lines, 10);
+	expect(&skip, NULL, 0);
+	lines = str_gen_split(str, '\n');
+	take = str_gen_take(&lines, 0);
+	expect(&take, NULL, 0);
+
+	/* nested split of an empty source */
+	lines = str_gen_split((struct str_slice){ .d = "", .len = 0 }, '\n');
+	rows = str_gen_nonempty(&lines);
+	fields = str_gen_split_each(&rows, ',');
+	expect(&fields, NULL, 0);
+}
+
+static int naive_find(const char *h, int hl, const char *n, int nl,
+		int from) {
+	for (int i = from; i + nl <= hl; ++i) {
+		if (memcmp(h + i, n, nl) == 0) return i;
+	}
+	return -1;
+}
+
+static void test_find() {
+	static char h[3000], n[100];
+	srand(4);
+	for (int it = 0; it < 2000; ++it) {
+		/* small alphabets give many partial matches */
+		int alpha = 1 + rand() % 4;
+		int hl = rand() % sizeof(h), nl = 1 + rand() % 80;
+		for (int i = 0; i < hl; ++i) h[i] = 'a' + rand() % alpha;
+		if (it % 2 && hl >= nl) {
+			/* a needle that does occur */
+			memcpy(n, h + rand() % (hl - nl + 1), nl);
+		} else if (it % 3 == 0) {
+			/* a periodic one */
+			int p = 1 + rand() % 5;
+			for (int i = 0; i < nl; ++i) {
+				n[i] = i < p ? 'a' + rand() % alpha : n[i - p];
+			}
+		} else {
+			for (int i = 0; i < nl; ++i) {
+				n[i] = 'a' + rand() % alpha;
+			}
+		}
+		struct str_slice hs = { .d = h, .len = hl };
+		struct str_slice ns = { .d = n, .len = nl };
+		int from = hl ? rand() % hl : 0;
+		asrt(str_find(hs, ns, from) == naive_find(h, hl, n, nl, from),
+			"str_find");
+
+		struct str_gen g = str_gen_find(hs, ns);
+		struct str_slice s;
+		int i = 0;
+		while ((i = naive_find(h, hl, n, nl, i)) >= 0) {
+			asrt(str_gen_next(&g, &s), "find too short");
+			asrt(s.d == h + i && s.len == nl, "find");
+			i += nl;
+		}
+		asrt(!str_gen_next(&g, &s), "find too long");
+	}
+	struct str_slice e = { .d = "", .len = 0 };
+	asrt(str_find((struct str_slice){ .d = "ab", .len = 2 }, e, 1) == 1,
+		"empty needle");
+	asrt(str_find(e, (struct str_slice){ .d = "ab", .len = 2 }, 0) == -1,
+		"empty hay");
+}
+
+static void test_find_any() {
+	struct str_slice pats[] = {
+		{ "he", 2 }, { "she", 3 }, { "his", 3 }, { "hers", 4 },
+		{ "s", 1 }, { "he", 2 },
+	};
+	int np = sizeof(pats) / sizeof(pats[0]);
+	struct str_matcher m;
+	asrt(str_matcher_init(&m, pats, np), "matcher");
+
+	const char *text = "ushers and his sheep, hehe";
+	int tl = strlen(text);
+	struct str_gen g = str_gen_find_any(
+		(struct str_slice){ .d = text, .len = tl }, &m);
+	struct str_slice s;
+	int prev_end = 0, prev_len = 0, count = 0;
+	while (str_gen_next(&g, &s)) {
+		int p = str_gen_find_any_pattern(&g);
+		asrt(p >= 0 && p < 5, "pattern index");
+		asrt(s.len == pats[p].len && memcmp(s.d, pats[p].d, s.len) == 0,
+			"match");
+		int end = s.d + s.len - text;
+		asrt(end > prev_end || (end == prev_end && s.len < prev_len),
+			"order");
+		prev_end = end;
+		prev_len = s.len;
+		++count;
+	}
+	/* compare the number of matches with a naive count */
+	int expected = 0;
+	for (int i = 0; i < tl; ++i) {
+		for (int j = 0; j < 5; ++j) {
+			expected += i + pats[j].len <= tl && memcmp(
+				text + i, pats[j].d, pats[j].len) == 0;
+		}
+	}
+	asrt(count == expected, "match count");
+	str_matcher_finish(&m);
+}
+
+static bool utf8_valid_ref(const char *d, int len) {
+	/* through the scalar decoder of the codepoint generator */
+	struct str_gen g = str_gen_codepoints((struct str_slice){
+		.d = d, .len = len });
+	struct str_slice s;
+	while (str_gen_next(&g, &s)) {
+		if (str_gen_codepoint(&g) < 0) return false;
+	}
+	return true;
+}
+
+/* The bulk codepoints agree with the ones of str_gen_next. */
+static void check_codepoints_bulk(const char *d, int len) {
+	struct str_gen g = str_gen_codepoints((struct str_slice){
+		.d = d, .len = len });
+	struct str_gen b = g;
+	int32_t out[40];
+	int k = 0, r = 0;
+	struct str_slice s;
+	while (str_gen_next(&g, &s)) {
+		if (k == r) {
+			r = str_gen_codepoints_bulk(&b, out, 1 + rand() % 40);
+			k = 0;
+			asrt(r > 0, "bulk ended early");
+			asrt(str_gen_codepoint(&b) == out[r - 1], "bulk last");
+		}
+		asrt(out[k++] == str_gen_codepoint(&g), "bulk codepoint");
+	}
+	asrt(k == r && str_gen_codepoints_bulk(&b, out, 40) == 0, "bulk end");
+}
+
+static void test_utf8() {
+	struct { const char *s; bool valid; } cases[] = {
+		{ "", true },
+		{ "hello", true },
+		{ "\xc3\xa9t\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80", true },
+		{ "\xc0\xaf", false }, /* overlong */
+		{ "\xe0\x80\xaf", false }, /* overlong */
+		{ "\xed\xa0\x80", false }, /* surrogate */
+		{ "\xf4\x90\x80\x80", false }, /* over U+10FFFF */
+		{ "\xf4\x8f\xbf\xbf", true }, /* U+10FFFF */
+		{ "\x80", false }, /* lone continuation */
+		{ "\xe2\x82", false }, /* truncated */
+		{ "\xff", false },
+	};
+	for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		struct str_slice s = { cases[i].s, strlen(cases[i].s) };
+		asrt(str_slice_utf8_valid(s) == cases[i].valid, "utf8 case");
+		asrt(utf8_valid_ref(s.d, s.len) == cases[i].valid, "ref case");
+	}
+
+	/* random mixes of valid sequences, with a few broken bytes */
+	static const char *pieces[] = {
+		"a", "xyz0123456789", "\xc3\xa9", "\xe2\x82\xac",
+		"\xf0\x9f\x98\x80", "\xed\x9f\xbf", "\xee\x80\x80",
+	};
+	static char buf[300];
+	srand(5);
+	for (int it = 0; it < 20000; ++it) {
+		int len = 0;
+		int target = rand() % 250;
+		while (len < target) {
+			const char *p = pieces[rand() % 7];
+			int l = strlen(p);
+			memcpy(buf + len, p, l);
+			len += l;
+		}
+		if (it % 2) {
+			int k = 1 + rand() % 3;
+			for (int j = 0; j < k && len; ++j) {
+				buf[rand() % len] = rand() % 256;
+			}
+		}
+		if (it % 5 == 0 && len) len -= rand() % 4 % len;
+		struct str_slice s = { buf, len };
+		asrt(str_slice_utf8_valid(s) == utf8_valid_ref(buf, len),
+			"utf8 random");
+		check_codepoints_bulk(buf, len);
+	}
+
+	struct str str = str_new_from_cstr("\xc3\xa9t\xc3\xa9");
+	asrt(str_utf8_valid(&str), "str");
+	str_free(&str);
+
+	const char *text = "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xffz";
+	int32_t cps[] = { 'a', 0xe9, 0x20ac, 0x1f600, -1, 'z' };
+	int lens[] = { 1, 2, 3, 4, 1, 1 };
+	struct str_gen g = str_gen_codepoints((struct str_slice){
+		.d = text, .len = strlen(text) });
+	struct str_slice s;
+	int i = 0;
+	while (str_gen_next(&g, &s)) {
+		asrt(i < 6, "too many codepoints");
+		asrt(str_gen_codepoint(&g) == cps[i] && s.len == lens[i],
+			"codepoint");
+		++i;
+	}
+	asrt(i == 6, "too few codepoints");
 }
 
 int main() {
@@ -31,4 +496,12 @@ int main() {
 		(const char *[]){ "", "" }, 2);
 	test_str_gen_split("hello world", ' ',
 		(const char *[]){ "hello", "world" }, 2);
+	test_split_long();
+	test_csv_all();
+	test_split_stream();
+	test_split_parallel();
+	test_pipeline();
+	test_find();
+	test_find_any();
+	test_utf8();
 }
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/matrix.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static float frand(float lo, float hi) {
+	return lo + (hi - lo) * rand() / (float)RAND_MAX;
+}
+
+static bool close_to(float a, double b) {
+	return fabs(a - b) <= 1e-4 * fmax(1, fabs(b));
+}
+
+static void ref_apply(const float m[9], double *rx, double *ry, float x,
+		float y, bool proj) {
+	*rx = (double)m[0] * x + (double)m[1] * y + m[2];
+	*ry = (double)m[3] * x + (double)m[4] * y + m[5];
+	if (proj) {
+		double w = (double)m[6] * x + (double)m[7] * y + m[8];
+		*rx /= w;
+		*ry /= w;
+	}
+}
+
+static void test_apply() {
+	enum { N = 77 };
+	float in[2 * N], out[2 * N], x[N], y[N], ox[N], oy[N];
+	srand(8);
+	for (int it = 0; it < 200; ++it) {
+		float m[9];
+		for (int i = 0; i < 6; ++i) m[i] = frand(-10, 10);
+		/* keep w away from 0 */
+		m[6] = frand(-0.01, 0.01);
+		m[7] = frand(-0.01, 0.01);
+		m[8] = frand(1, 2);
+		int n = rand() % (N + 1);
+		for (int i = 0; i < n; ++i) {
+			x[i] = in[2 * i] = frand(-50, 50);
+			y[i] = in[2 * i + 1] = frand(-50, 50);
+		}
+
+		for (int proj = 0; proj < 2; ++proj) {
+			if (proj) {
+				mat3_apply(m, out, in, n);
+				mat3_apply_soa(m, ox, oy, x, y, n);
+			} else {
+				mat3_apply_affine(m, out, in, n);
+				mat3_apply_affine_soa(m, ox, oy, x, y, n);
+			}
+			for (int i = 0; i < n; ++i) {
+				double rx, ry;
+				ref_apply(m, &rx, &ry, x[i], y[i], proj);
+				asrt(close_to(out[2 * i], rx)
+					&& close_to(out[2 * i + 1], ry), "aos");
+				asrt(close_to(ox[i], rx) && close_to(oy[i], ry),
+					"soa");
+			}
+		}
+
+		/* in place */
+		memcpy(out, in, sizeof(float) * 2 * n);
+		mat3_apply(m, out, out, n);
+		memcpy(ox, x, sizeof(float) * n);
+		memcpy(oy, y, sizeof(float) * n);
+		mat3_apply_soa(m, ox, oy, ox, oy, n);
+		for (int i = 0; i < n; ++i) {
+			double rx, ry;
+			ref_apply(m, &rx, &ry, x[i], y[i], true);
+			asrt(close_to(out[2 * i], rx)
+				&& close_to(out[2 * i + 1], ry),
+				"aos in place");
+			asrt(close_to(ox[i], rx) && close_to(oy[i], ry),
+				"soa in place");
+		}
+	}
+
+	/* the matrices built by the existing functions */
+	float m[9];
+	mat3_ident(m);
+	mat3_tran(m, (float[]){ 3, 4 });
+	float p[2] = { 1, 2 };
+	mat3_apply(m, p, p, 1);
+	asrt(p[0] == 4 && p[1] == 6, "translation");
+
+	mat3_ident(m);
+	mat3_proj(m, (int[]){ 200, 100 });
+	float q[4] = { 0, 0, 200, 100 };
+	mat3_apply_affine(m, q, q, 2);
+	asrt(q[0] == -1 && q[1] == 1 && q[2] == 1 && q[3] == -1, "proj");
+}
+
+/* the old definitions, through full 3x3 multiplications */
+static void ref_tran(float m[9], float tx, float ty) {
+	mat3_mul_l(m, (float[]){ 1, 0, tx, 0, 1, ty, 0, 0, 1 });
+}
+
+static void ref_scale(float m[9], float sx, float sy) {
+	mat3_mul_l(m, (float[]){ sx, 0, 0, 0, sy, 0, 0, 0, 1 });
+}
+
+static void ref_rot(float m[9], float a) {
+	mat3_mul_l(m, (float[]){
+		cos(a), -sin(a), 0,
+		sin(a), cos(a), 0,
+		0, 0, 1,
+	});
+}
+
+static void test_affine() {
+	srand(9);
+	for (int it = 0; it < 200; ++it) {
+		float m[9], r[9], a[6], a3[9];
+		for (int i = 0; i < 9; ++i) m[i] = r[i] = frand(-10, 10);
+		mat2x3_ident(a);
+		mat3_ident(a3);
+		for (int k = 0; k < 8; ++k) {
+			float t[2] = { frand(-10, 10), frand(-10, 10) };
+			float ang = frand(-4, 4);
+			switch (rand() % 3) {
+			case 0:
+				mat3_tran(m, t);
+				ref_tran(r, t[0], t[1]);
+				mat2x3_tran(a, t);
+				ref_tran(a3, t[0], t[1]);
+				break;
+			case 1:
+				mat3_scale(m, t);
+				ref_scale(r, t[0], t[1]);
+				mat2x3_scale(a, t);
+				ref_scale(a3, t[0], t[1]);
+				break;
+			case 2:
+				mat3_rot(m, ang);
+				ref_rot(r, ang);
+				mat2x3_rot(a, ang);
+				ref_rot(a3, ang);
+				break;
+			}
+		}
+		for (int i = 0; i < 9; ++i) {
+			asrt(fabsf(m[i] - r[i]) <= 1e-3 * fmaxf(1, fabsf(r[i])),
+				"mat3 closed form");
+		}
+		for (int i = 0; i < 6; ++i) {
+			asrt(fabsf(a[i] - a3[i])
+				<= 1e-3 * fmaxf(1, fabsf(a3[i])), "mat2x3");
+		}
+
+		/* compose, and compose with the inverse */
+		float b[6], c[6], b3[9], c3[9];
+		for (int i = 0; i < 6; ++i) b[i] = frand(-10, 10);
+		memcpy(c, a, sizeof(c));
+		mat2x3_mul_l(c, b);
+		mat2x3_to_mat3(b3, b);
+		mat2x3_to_mat3(c3, a);
+		mat3_mul_l(c3, b3);
+		for (int i = 0; i < 6; ++i) {
+			asrt(fabsf(c[i] - c3[i])
+				<= 1e-3 * fmaxf(1, fabsf(c3[i])), "mul_l");
+		}
+		asrt(c3[6] == 0 && c3[7] == 0 && c3[8] == 1, "to_mat3");
+
+		float inv[6];
+		asrt(mat2x3_invert(inv, b), "invertible");
+		mat2x3_mul_l(inv, b);
+		const float ident[6] = { 1, 0, 0, 0, 1, 0 };
+		for (int i = 0; i < 6; ++i) {
+			asrt(fabsf(inv[i] - ident[i]) <= 1e-3, "invert");
+		}
+
+		float p[2] = { frand(-50, 50), frand(-50, 50) }, q[2];
+		mat2x3_apply(b, q, p, 1);
+		double rx, ry;
+		ref_apply(b3, &rx, &ry, p[0], p[1], false);
+		asrt(close_to(q[0], rx) && close_to(q[1], ry), "apply");
+	}
+
+	float s[6] = { 1, 2, 3, 2, 4, 5 }, inv[6];
+	asrt(!mat2x3_invert(inv, s), "singular");
+}
+
+int main() {
+	test_apply();
+	test_affine();
+}
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/parse.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct str_slice sl(const char *s) {
+	return (struct str_slice){ .d = s, .len = strlen(s) };
+}
+
+static void test_int() {
+	int64_t v;
+	uint64_t u;
+	asrt(str_parse_i64(sl("0"), &v) && v == 0, "0");
+	asrt(str_parse_i64(sl("-12345678901234"), &v)
+		&& v == -12345678901234, "negative");
+	asrt(str_parse_i64(sl("+42"), &v) && v == 42, "plus");
+	asrt(str_parse_i64(sl("9223372036854775807"), &v)
+		&& v == INT64_MAX, "max");
+	asrt(str_parse_i64(sl("-9223372036854775808"), &v)
+		&& v == INT64_MIN, "min");
+	asrt(!str_parse_i64(sl("9223372036854775808"), &v), "overflow");
+	asrt(!str_parse_i64(sl("-9223372036854775809"), &v), "underflow");
+	asrt(str_parse_u64(sl("18446744073709551615"), &u)
+		&& u == UINT64_MAX, "u64 max");
+	asrt(!str_parse_u64(sl("18446744073709551616"), &u), "u64 overflow");
+	asrt(!str_parse_u64(sl("184467440737095516150"), &u), "21 digits");
+	asrt(str_parse_u64(sl("000000000000000000000000001"), &u) && u == 1,
+		"leading zeros");
+	const char *bad[] = { "", "-", "+", "1a", "a1", " 1", "1 ", "--1",
+		"12345678x", "1.0" };
+	for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		asrt(!str_parse_i64(sl(bad[i]), &v), bad[i]);
+	}
+
+	/* against strtoll, on random lengths (crossing the 8 digit runs) */
+	char buf[32];
+	srand(6);
+	for (int it = 0; it < 100000; ++it) {
+		int64_t x = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20)
+			^ rand();
+		x >>= rand() % 63;
+		if (rand() % 2) x = -x;
+		snprintf(buf, sizeof(buf), "%" PRId64, x);
+		asrt(str_parse_i64(sl(buf), &v) && v == x, "random int");
+	}
+}
+
+static void check_double(const char *s) {
+	char *end;
+	double ref = strtod(s, &end);
+	double v;
+	bool ok = str_parse_double(sl(s), &v);
+	/* unlike strtod, leading whitespace is not skipped, and overflow is
+	 * an error */
+	bool overflow = isinf(ref) && !strpbrk(s, "iI");
+	asrt(ok == (*s && *s != ' ' && *end == '\0' && !overflow), s);
+	if (ok) {
+		asrt(memcmp(&v, &ref, sizeof(v)) == 0 || (v != v && ref != ref),
+			s);
+	}
+}
+
+static void test_double() {
+	const char *cases[] = {
+		"0", "-0", "1", "1.5", "-2.25", ".5", "5.", "1e10", "1E-10",
+		"3.141592653589793", "2.2250738585072014e-308", "4.9e-324",
+		"1.7976931348623157e308", "1e309", "1e-400", "9007199254740993",
+		"123456789012345678901234567890", "0.1", "0.30000000000000004",
+		"0.000000000000000000000000000001234", "1e22", "1e23",
+		"12345678.12345678e-5", "inf", "-nan", "0x1p3", "00012.5000",
+		"", ".", "e5", "1e", "1e+", "1.2.3", "1,5", " 1", "1 ", "+",
+		"1.5x", "0x", "-1e400", "0x1p5000", "1e-99999999", "infinity",
+		"2.4703282292062327e-324", "2.4703282292062328e-324",
+		"9007199254740993.000000000000000000000000000000001",
+		"9007199254740992.999999999999999999999999999999999",
+		"179769313486231580793728971405303415079934132710037826936173778"
+		"980444968292764750946649017977587207096330286416692887910946555"
+		"547851940402630657488671505820681908902000708383676273854845817"
+		"711531764475730270069855571366959622842914819860834936475292719"
+		"074168444365510704342711559699508093042880177904174497792",
+	};
+	for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		check_double(cases[i]);
+	}
+
+	char buf[64];
+	srand(7);
+	for (int it = 0; it < 100000; ++it) {
+		switch (it % 3) {
+		case 0: {
+			/* short decimal strings, mostly on the fast path */
+			int digits = 1 + rand() % 17;
+			int k = 0;
+			if (rand() % 2) buf[k++] = '-';
+			int dot = rand() % (digits + 1);
+			for (int j = 0; j < digits; ++j) {
+				if (j == dot) buf[k++] = '.';
+				buf[k++] = '0' + rand() % 10;
+			}
+			if (rand() % 2) {
+				k += sprintf(buf + k, "e%d", rand() % 60 - 30);
+			}
+			buf[k] = '\0';
+			break;
+		}
+		case 1: {
+			/* round trips of random doubles */
+			uint64_t bits = ((uint64_t)rand() << 42)
+				^ ((uint64_t)rand() << 21) ^ rand();
+			double x;
+			memcpy(&x, &bits, sizeof(x));
+			snprintf(buf, sizeof(buf), "%.17g", x);
+			break;
+		}
+		case 2:
+			snprintf(buf, sizeof(buf), "%.*g", 1 + rand() % 16,
+				(double)rand() / (1 + rand()));
+			break;
+		}
+		check_double(buf);
+	}
+}
+
+/* More significant digits than fit into 64 bits, close to the halfway
+ * points between doubles, where all of them matter. */
+static void test_double_long() {
+	static char buf[1200];
+	srand(8);
+	for (int it = 0; it < 20000; ++it) {
+		uint64_t bits = ((uint64_t)rand() << 42)
+			^ ((uint64_t)rand() << 21) ^ rand();
+		double x;
+		memcpy(&x, &bits, sizeof(x));
+		if (isnan(x) || isinf(x)) continue;
+		/* the halfway point to the next double (exact where long
+		 * double has at least 54 bits), truncated, then nudged */
+		long double up = nextafter(x, INFINITY);
+		long double h = x + (up - x) / 2;
+		int k = snprintf(buf, sizeof(buf) - 8, "%.*Le",
+			20 + rand() % 760, h);
+		char *e = strchr(buf, 'e');
+		int ke = k - (e - buf);
+		memmove(e + 1, e, ke + 1);
+		*e = '0' + rand() % 10;
+		check_double(buf);
+	}
+}
+
+static void test_column() {
+	const char *text = "1,-2,3,40000000000,5";
+	struct vec fields = vec_new_empty(sizeof(struct str_slice));
+	struct str_gen g = str_gen_split(sl(text), ',');
+	struct str_slice s;
+	while (str_gen_next(&g, &s)) vec_append(&fields, &s);
+
+	struct vec ints = vec_new_empty(sizeof(int64_t));
+	int bad;
+	asrt(str_parse_i64_column(&fields, &ints, &bad), "i64 column");
+	int64_t expected[] = { 1, -2, 3, 40000000000, 5 };
+	asrt(ints.len == 5 && memcmp(ints.d, expected, sizeof(expected)) == 0,
+		"i64 values");
+
+	struct vec doubles = vec_new_empty(sizeof(double));
+	asrt(str_parse_double_column(&fields, &doubles, &bad), "");
+	asrt(doubles.len == 5 && ((double *)doubles.d)[3] == 4e10, "");
+
+	/* an invalid field stops the parsing */
+	vec_clear(&fields);
+	g = str_gen_split(sl("7,8,x,9"), ',');
+	while (str_gen_next(&g, &s)) vec_append(&fields, &s);
+	vec_clear(&ints);
+	asrt(!str_parse_i64_column(&fields, &ints, &bad), "invalid");
+	asrt(bad == 2 && ints.len == 2, "invalid index");
+
+	vec_free(&fields);
+	vec_free(&ints);
+	vec_free(&doubles);
+}
+
+int main() {
+	test_int();
+	test_double();
+	test_double_long();
+	test_column();
+}
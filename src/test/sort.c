@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/sort.h>
+#include <stdint.h>
+#include <string.h>
+
+#define int_lt(a, b) ((a) < (b))
+DS_SORT_DEFINE(sort_int, int, int_lt)
+
+struct rec {
+	uint32_t key;
+	int idx;
+	char pad[7];
+};
+static inline bool rec_lt(struct rec a, struct rec b) {
+	return a.key < b.key;
+}
+DS_SORT_DEFINE(sort_rec, struct rec, rec_lt)
+
+static int cmp_int(const void *a, const void *b) {
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+static int cmp_rec(const void *a, const void *b) {
+	const struct rec *x = a, *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static uint32_t rng_state = 1;
+static uint32_t rng() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* inputs that trip up naive quicksorts */
+static void fill(int *a, int n, int pattern) {
+	for (int i = 0; i < n; ++i) {
+		switch (pattern) {
+		case 0: a[i] = rng(); break;
+		case 1: a[i] = i; break;
+		case 2: a[i] = n - i; break;
+		case 3: a[i] = 7; break;
+		case 4: a[i] = rng() % 4; break;
+		case 5: a[i] = i < n / 2 ? i : n - i; break;
+		case 6: a[i] = i % 2 ? i : -i; break;
+		default: a[i] = i ^ (i % 8 == 0 ? rng() : 0); break;
+		}
+	}
+}
+#define N_PATTERNS 8
+
+static void check_sorted(const int *a, const int *ref, int n) {
+	for (int i = 0; i < n; ++i) {
+		asrt(a[i] == ref[i], "sort result");
+	}
+}
+
+static void test_sort() {
+	static int a[20000], b[20000], ref[20000];
+	int sizes[] = { 0, 1, 2, 3, 23, 24, 25, 100, 128, 129, 1000, 20000 };
+	for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		int n = sizes[s];
+		for (int p = 0; p < N_PATTERNS; ++p) {
+			fill(a, n, p);
+			memcpy(b, a, n * sizeof(int));
+			memcpy(ref, a, n * sizeof(int));
+			qsort(ref, n, sizeof(int), cmp_int);
+
+			sort_int(a, n);
+			check_sorted(a, ref, n);
+
+			struct vec v = vec_new_empty(sizeof(int));
+			vec_append_multiple(&v, b, n);
+			vec_sort(&v, cmp_int);
+			check_sorted(v.d, ref, n);
+			vec_free(&v);
+		}
+	}
+}
+
+static void test_search() {
+	int a[100];
+	for (int i = 0; i < 100; ++i) a[i] = 2 * (i / 2);
+	struct vec v = vec_new_empty(sizeof(int));
+	vec_append_multiple(&v, a, 100);
+	for (int key = -1; key <= 100; ++key) {
+		int exp = 0;
+		while (exp < 100 && a[exp] < key) ++exp;
+		asrt(sort_int_lower_bound(a, 100, key) == exp, "lower_bound");
+		asrt(vec_lower_bound(&v, &key, cmp_int) == exp,
+			"vec_lower_bound");
+		int i = vec_bsearch(&v, &key, cmp_int);
+		if (key >= 0 && key < 100 && key % 2 == 0) {
+			asrt(i >= 0 && a[i] == key, "vec_bsearch");
+		} else {
+			asrt(i == -1, "vec_bsearch missing");
+		}
+	}
+	asrt(sort_int_lower_bound(a, 0, 5) == 0, "lower_bound empty");
+	vec_free(&v);
+}
+
+static void test_radix() {
+	int n = 50000;
+	struct vec v = vec_new_empty(sizeof(struct rec));
+	for (int i = 0; i < n; ++i) {
+		/* few distinct keys, so stability is visible */
+		struct rec r = { .key = (rng() % 1000) << 8, .idx = i };
+		vec_append(&v, &r);
+	}
+	struct vec w = vec_copy(&v);
+
+	asrt(vec_radix_sort(&v, offsetof(struct rec, key), 4, false), "");
+	for (int i = 1; i < n; ++i) {
+		const struct rec *x = vec_get(&v, i - 1), *y = vec_get(&v, i);
+		asrt(x->key < y->key || (x->key == y->key && x->idx < y->idx),
+			"radix sorted and stable");
+	}
+
+	sort_rec(w.d, w.len);
+	for (int i = 0; i < n; ++i) {
+		asrt(((struct rec *)vec_get(&v, i))->key
+			== ((struct rec *)vec_get(&w, i))->key, "sort_rec");
+	}
+	vec_free(&v);
+	vec_free(&w);
+
+	/* signed 8 byte keys */
+	long long ll[] = { 5, -3, 0, -(1LL << 62), 1LL << 62, -1, 3 };
+	long long ll_sorted[] = { -(1LL << 62), -3, -1, 0, 3, 5, 1LL << 62 };
+	v = vec_new_empty(sizeof(long long));
+	vec_append_multiple(&v, ll, 7);
+	asrt(vec_radix_sort(&v, 0, sizeof(long long), true), "");
+	asrt(memcmp(v.d, ll_sorted, sizeof(ll_sorted)) == 0, "signed radix");
+	vec_free(&v);
+}
+
+static void test_parallel() {
+	int n = 300001;
+	struct vec v = vec_new_empty(sizeof(struct rec));
+	for (int i = 0; i < n; ++i) {
+		struct rec r = { .key = rng() % 5000, .idx = i };
+		vec_append(&v, &r);
+	}
+	for (int t = 1; t <= 5; t += 2) {
+		struct vec w = vec_copy(&v);
+		vec_sort_parallel(&w, cmp_rec, t);
+		long long sum = 0;
+		for (int i = 0; i < n; ++i) {
+			const struct rec *y = vec_get(&w, i);
+			if (i > 0) {
+				const struct rec *x = vec_get(&w, i - 1);
+				asrt(x->key <= y->key, "parallel sorted");
+			}
+			sum += y->idx;
+		}
+		asrt(sum == (long long)n * (n - 1) / 2, "parallel permutation");
+		vec_free(&w);
+	}
+	vec_free(&v);
+}
+
+int main() {
+	test_sort();
+	test_search();
+	test_radix();
+	test_parallel();
+}
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include "../core.h"
+#include <ds/matrix.h>
+#include <ds/spatial.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static float frand(float lo, float hi) {
+	return lo + (hi - lo) * rand() / (float)RAND_MAX;
+}
+
+/* small integer coordinates, to get boxes sharing edges and corners */
+static void rand_box(float b[static 4], bool coarse) {
+	if (coarse) {
+		b[0] = rand() % 100;
+		b[1] = rand() % 100;
+		b[2] = rand() % 8;
+		b[3] = rand() % 8;
+	} else {
+		b[0] = frand(-20, 120);
+		b[1] = frand(-20, 120);
+		b[2] = frand(0, 10);
+		b[3] = frand(0, 10);
+	}
+}
+
+static void rand_point(float p[static 2], bool coarse) {
+	if (coarse) {
+		p[0] = rand() % 110 - 5;
+		p[1] = rand() % 110 - 5;
+	} else {
+		p[0] = frand(-30, 130);
+		p[1] = frand(-30, 130);
+	}
+}
+
+static int cmp_int(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+static float dist2(const float b[static 4], const float p[static 2]) {
+	float dx = fmaxf(fmaxf(b[0] - p[0], p[0] - (b[0] + b[2])), 0);
+	float dy = fmaxf(fmaxf(b[1] - p[1], p[1] - (b[1] + b[3])), 0);
+	return dx * dx + dy * dy;
+}
+
+static bool overlaps(const float a[static 4], const float b[static 4]) {
+	float is[4];
+	aabb_intersect(is, a, b);
+	return is[2] > 0 && is[3] > 0;
+}
+
+/* Compares a query result with the expected indices, as sets. */
+static void check_set(struct vec *got, struct vec *exp, const char *msg) {
+	asrt(got->len == exp->len, msg);
+	if (got->len > 0) {
+		qsort(got->d, got->len, sizeof(int), cmp_int);
+		qsort(exp->d, exp->len, sizeof(int), cmp_int);
+		asrt(memcmp(got->d, exp->d, got->len * sizeof(int)) == 0, msg);
+	}
+	vec_clear(got);
+	vec_clear(exp);
+}
+
+/* The nearest boxes can tie, so compare the distances only. */
+static void check_nearest(struct vec *got, const float *boxes,
+		const bool *alive, int n, const float p[static 2], int k,
+		const char *msg) {
+	struct vec all = vec_new_empty(sizeof(float));
+	for (int i = 0; i < n; ++i) {
+		if (alive && !alive[i]) continue;
+		float d = dist2(boxes + 4 * i, p);
+		vec_append(&all, &d);
+	}
+	float *d = all.d;
+	for (int i = 1; i < all.len; ++i) {
+		for (int j = i; j > 0 && d[j] < d[j - 1]; --j) {
+			float t = d[j];
+			d[j] = d[j - 1];
+			d[j - 1] = t;
+		}
+	}
+	int exp = k < all.len ? k : all.len;
+	asrt(got->len == exp, msg);
+	const int *ids = got->d;
+	for (int i = 0; i < exp; ++i) {
+		asrt(!alive || alive[ids[i]], msg);
+		asrt(dist2(boxes + 4 * ids[i], p) == d[i], msg);
+	}
+	vec_free(&all);
+	vec_clear(got);
+}
+
+static void test_tree() {
+	srand(50);
+	struct vec got = vec_new_empty(sizeof(int));
+	struct vec exp = vec_new_empty(sizeof(int));
+	const int sizes[] = { 0, 1, 15, 16, 17, 256, 257, 3000 };
+	for (int si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si) {
+		int n = sizes[si];
+		bool coarse = si % 2;
+		float *boxes = malloc(4 * sizeof(float) * (n + 1));
+		for (int i = 0; i < n; ++i) rand_box(boxes + 4 * i, coarse);
+
+		struct aabb_tree t;
+		asrt(aabb_tree_build(&t, boxes, n, NULL), "build");
+		for (int it = 0; it < 200; ++it) {
+			float p[2];
+			rand_point(p, coarse);
+			asrt(aabb_tree_query_point(&t, p, &got), "point");
+			for (int i = 0; i < n; ++i) {
+				if (aabb_contains(boxes + 4 * i, p)) {
+					vec_append(&exp, &i);
+				}
+			}
+			check_set(&got, &exp, "tree point");
+
+			float r[4];
+			rand_box(r, coarse);
+			asrt(aabb_tree_query_rect(&t, r, &got), "rect");
+			for (int i = 0; i < n; ++i) {
+				if (overlaps(boxes + 4 * i, r)) {
+					vec_append(&exp, &i);
+				}
+			}
+			check_set(&got, &exp, "tree rect");
+
+			int k = it % 5 == 0 ? n + 3 : rand() % 10;
+			asrt(aabb_tree_nearest(&t, p, k, &got), "nearest");
+			check_nearest(&got, boxes, NULL, n, p, k,
+				"tree nearest");
+		}
+		aabb_tree_finish(&t);
+		free(boxes);
+	}
+	vec_free(&got);
+	vec_free(&exp);
+}
+
+static void test_grid() {
+	srand(51);
+	enum { N = 600 };
+	struct vec got = vec_new_empty(sizeof(int));
+	struct vec exp = vec_new_empty(sizeof(int));
+	for (int coarse = 0; coarse < 2; ++coarse) {
+		float boxes[4 * N];
+		bool alive[N] = { 0 };
+		struct aabb_grid g;
+		asrt(aabb_grid_init(&g, (float[]){ 0, 0, 100, 100 },
+			coarse ? 10 : 7.5, NULL), "init");
+
+		int n = 0;
+		for (int it = 0; it < 2000; ++it) {
+			int op = rand() % 4;
+			if (op == 0 && n < N) {
+				float b[4];
+				rand_box(b, coarse);
+				int id = aabb_grid_insert(&g, b);
+				asrt(id >= 0 && id <= n, "insert id");
+				asrt(id == n || !alive[id], "reused id");
+				if (id == n) ++n;
+				memcpy(boxes + 4 * id, b, sizeof(b));
+				alive[id] = true;
+			} else if (op == 1 && n > 0) {
+				int id = rand() % n;
+				if (!alive[id]) continue;
+				if (rand() % 2) {
+					aabb_grid_remove(&g, id);
+					alive[id] = false;
+				} else {
+					float b[4];
+					rand_box(b, coarse);
+					asrt(aabb_grid_move(&g, id, b), "move");
+					memcpy(boxes + 4 * id, b, sizeof(b));
+				}
+			}
+
+			float p[2];
+			rand_point(p, coarse);
+			asrt(aabb_grid_query_point(&g, p, &got), "point");
+			for (int i = 0; i < n; ++i) {
+				if (!alive[i]) continue;
+				if (aabb_contains(boxes + 4 * i, p)) {
+					vec_append(&exp, &i);
+				}
+			}
+			check_set(&got, &exp, "grid point");
+
+			float r[4];
+			rand_box(r, coarse);
+			r[2] *= 3;
+			asrt(aabb_grid_query_rect(&g, r, &got), "rect");
+			for (int i = 0; i < n; ++i) {
+				if (alive[i] && overlaps(boxes + 4 * i, r)) {
+					vec_append(&exp, &i);
+				}
+			}
+			check_set(&got, &exp, "grid rect");
+
+			int k = it % 50 == 0 ? n + 3 : rand() % 10;
+			asrt(aabb_grid_nearest(&g, p, k, &got), "nearest");
+			check_nearest(&got, boxes, alive, n, p, k,
+				"grid nearest");
+		}
+		aabb_grid_finish(&g);
+	}
+	vec_free(&got);
+	vec_free(&exp);
+
+	/* too many cells */
+	struct aabb_grid g;
+	asrt(!aabb_grid_init(&g, (float[]){ 0, 0, 100, 100 }, 1e-30, NULL),
+		"cell count overflow");
+	asrt(!aabb_grid_init(&g, (float[]){ 0, 0, 1e30, 1 }, 1, NULL),
+		"column count overflow");
+	asrt(!aabb_grid_init(&g, (float[]){ 0, 0, 1e5, 1e5 }, 1, NULL),
+		"cols * rows overflow");
+}
+
+int main() {
+	test_tree();
+	test_grid();
+}
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-3.0-only
 #include "../core.h"
 #include <ds/tree.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 static void test_interval_overlap() {
 	struct { long long int a1, a2, b1, b2; bool c; } d[] = {
@@ -20,7 +22,11 @@ static void test_interval_overlap() {
 struct aug_node {
 	int post_iter_test;
 	int key, aug;
-	struct rb_node node;
+	/* tnode is used in threaded trees */
+	union {
+		struct rb_node node;
+		struct rb_threaded_node tnode;
+	};
 };
 
 static int check_rb_tree_len(struct rb_tree *T, struct rb_node *x) {
@@ -97,15 +103,23 @@ static void test_iter(struct rb_tree *T, int exp_n) {
 	int prev = 0;
 	int iter_n = 0;
 	struct rb_iter iter = rb_iter(T, RB_ITER_ORDER_IN);
-	struct rb_node *x;
+	struct rb_node *x, *prev_x = &T->nil;
 	while (rb_iter_next(&iter, &x)) {
 		++iter_n;
 		struct aug_node *nx = container_of(x, struct aug_node, node);
 		asrt(nx->key >= prev, "inorder iter");
+		asrt(rb_predecessor(T, x) == prev_x, "predecessor");
+		if (prev_x != &T->nil) {
+			asrt(rb_successor(T, prev_x) == x, "successor");
+		}
 		nx->post_iter_test = 0;
 		prev = nx->key;
+		prev_x = x;
 	}
 	asrt(iter_n == exp_n, "exp_n");
+	if (prev_x != &T->nil) {
+		asrt(rb_successor(T, prev_x) == &T->nil, "last successor");
+	}
 
 	iter_n = 0;
 	iter = rb_iter(T, RB_ITER_ORDER_POST);
@@ -124,12 +138,16 @@ static void test_iter(struct rb_tree *T, int exp_n) {
 	}
 	asrt(iter_n == exp_n, "exp_n");
 }
-static void test_rb_tree() {
+static void test_rb_tree(bool threaded) {
 	struct rb_tree T;
 	struct rb_tree_ops ops = { .lt = f_lt, .update = f_update };
 	struct aug_node n[0x100];
 
-	rb_tree_init(&T, &ops);
+	if (threaded) {
+		rb_tree_init_threaded(&T, &ops);
+	} else {
+		rb_tree_init(&T, &ops);
+	}
 
 	for (int i = 0; i < 0x100; ++i) {
 		struct aug_node *ni = &n[i];
@@ -147,15 +165,75 @@ static void test_rb_tree() {
 	}
 }
 
+static void test_rb_build_threaded() {
+	struct rb_tree T;
+	struct rb_tree_ops ops = { .lt = f_lt, .update = f_update };
+	struct aug_node n[100];
+	for (int len = 0; len <= 100; len += 25) {
+		rb_tree_init_threaded(&T, &ops);
+		for (int i = 0; i < len; ++i) n[i].key = i;
+		if (len > 0) rb_build_sorted(&T, &n[0].node, len, sizeof(n[0]));
+		check_rb_tree(&T);
+		test_iter(&T, len);
+	}
+}
+
+static void test_rb_tree_batch() {
+	struct rb_tree T;
+	struct rb_tree_ops ops = { .lt = f_lt, .update = f_update };
+	struct aug_node n[0x100];
+
+	rb_tree_init(&T, &ops);
+
+	rb_batch_begin(&T);
+	for (int i = 0; i < 0x100; ++i) {
+		struct aug_node *ni = &n[i];
+		ni->key = (i * 8121 + 1) % 0x100;
+		ni->aug = 0;
+		rb_insert(&T, &ni->node);
+	}
+	rb_batch_commit(&T);
+	check_rb_tree(&T);
+	test_iter(&T, 0x100);
+
+	/* mixed deletes and re-inserts inside a single batch */
+	rb_batch_begin(&T);
+	for (int i = 0; i < 0x100; i += 2) {
+		rb_delete(&T, &n[(i * 0x35) % 0x100].node);
+	}
+	for (int i = 0; i < 0x100; i += 4) {
+		n[i].aug = 0;
+		rb_insert(&T, &n[i].node);
+	}
+	rb_batch_commit(&T);
+	check_rb_tree(&T);
+	test_iter(&T, 0x80 + 0x40);
+
+	struct rb_iter iter = rb_iter(&T, RB_ITER_ORDER_IN);
+	struct rb_node *x;
+	while (rb_iter_next(&iter, &x)) {
+		asrt(!x->dirty, "dirty after commit");
+	}
+}
+
 static void test_interval_query(struct rb_tree *T,
 		long long int ran[static 2]) {
 	struct rb_iter iter = rb_iter(T, RB_ITER_ORDER_IN);
 	int n_exp = 0;
+	long long int end = ran[0], covered_exp = 0;
 	struct rb_node *x;
 	while (rb_iter_next(&iter, &x)) {
 		struct interval_node *nx =
 			container_of(x, struct interval_node, node);
 		if (interval_overlap(ran, nx->ran)) ++n_exp;
+
+		/* intervals come in increasing lo order, merge them */
+		long long int lo = nx->lo > end ? nx->lo : end;
+		long long int hi = nx->hi < ran[1] ? nx->hi : ran[1];
+		if (lo < hi) {
+			covered_exp += hi - lo;
+			end = hi;
+		}
 	}
 
 	int n = 0;
@@ -169,6 +247,8 @@ static void test_interval_query(struct rb_tree *T,
 	}
 
 	asrt(n == n_exp, __func__);
+	asrt(interval_count(T, ran) == n_exp, "interval_count");
+	asrt(interval_covered(T, ran) == covered_exp, "interval_covered");
 }
 
 static void test_interval_query_sweep(struct rb_tree *T,
@@ -203,8 +283,141 @@ static void test_interval_tree() {
 	}
 }
 
+static void test_interval_index() {
+	enum { N = 300 };
+	struct interval_index I;
+	struct interval_index_node n[N];
+	interval_index_init(&I);
+	srand(27);
+
+	/* nested intervals, the worst case of interval_count */
+	for (int i = 0; i < N; ++i) {
+		n[i].iv.lo = i % 2 ? i : rand() % 64;
+		n[i].iv.hi = n[i].iv.lo + (i % 3 ? 2 * N - i : rand() % 8);
+		interval_index_insert(&I, &n[i]);
+	}
+	for (int it = 0; it < 2 * N; ++it) {
+		if (it % 2 == 0) {
+			int i = it / 2;
+			interval_index_delete(&I, &n[i]);
+			if (i % 4 == 0) interval_index_insert(&I, &n[i]);
+		}
+		long long int ran[2] = { rand() % (3 * N), rand() % (3 * N) };
+		int exp = 0;
+		struct rb_iter iter = rb_iter(&I.by_lo, RB_ITER_ORDER_IN);
+		struct rb_node *x;
+		while (rb_iter_next(&iter, &x)) {
+			struct interval_node *nx =
+				container_of(x, struct interval_node, node);
+			if (interval_overlap(ran, nx->ran)) ++exp;
+		}
+		if (ran[0] >= ran[1]) exp = 0;
+		asrt(interval_index_count(&I, ran) == exp,
+			"interval_index_count");
+		asrt(interval_index_covered(&I, ran)
+			== interval_covered(&I.by_lo, ran),
+			"interval_index_covered");
+	}
+
+	/* disjoint intervals, with gaps, touching and empty ones */
+	interval_index_init(&I);
+	for (int i = 0; i < N; ++i) {
+		n[i].iv.lo = 4 * i + rand() % 3;
+		n[i].iv.hi = n[i].iv.lo + rand() % 4;
+		interval_index_insert(&I, &n[i]);
+	}
+	for (int it = 0; it < 2 * N; ++it) {
+		long long int a = rand() % (5 * N) - 10, b = rand() % (5 * N);
+		long long int ran[2] = { a < b ? a : b, a < b ? b : a };
+		asrt(interval_index_covered(&I, ran)
+			== interval_covered(&I.by_lo, ran),
+			"interval_index_covered disjoint");
+		if (it % 3 == 0) {
+			int i = rand() % N;
+			interval_index_delete(&I, &n[i]);
+			n[i].iv.hi = n[i].iv.lo + rand() % 6;
+			interval_index_insert(&I, &n[i]);
+		}
+	}
+}
+
+static void test_save_load() {
+	struct rb_tree T;
+	struct interval_node n[0x100];
+
+	rb_tree_init(&T, &interval_ops);
+	for (int i = 0; i < 0x100; ++i) {
+		n[i].lo = (i * 8121 + 1) % 0x80;
+		n[i].hi = n[i].lo + i;
+		rb_insert(&T, &n[i].node);
+	}
+
+	for (int len = 0x100; len >= 0; len -= 0x40) {
+		const char *path = "test_tree_save_load.bin";
+		asrt(interval_save(&T, path), "interval_save");
+
+		struct rb_tree L;
+		struct interval_node *ln;
+		int ln_n;
+		rb_tree_init(&L, &interval_ops);
+		asrt(interval_load(&L, path, &ln, &ln_n), "interval_load");
+		asrt(ln_n == len, "loaded count");
+		asrt(L.root->color == 1, "root color");
+		check_rb_tree_len(&L, L.root);
+
+		struct rb_iter a = rb_iter(&T, RB_ITER_ORDER_IN);
+		struct rb_iter b = rb_iter(&L, RB_ITER_ORDER_IN);
+		struct rb_node *x, *y;
+		while (rb_iter_next(&a, &x)) {
+			asrt(rb_iter_next(&b, &y), "loaded too short");
+			struct interval_node *nx =
+				container_of(x, struct interval_node, node);
+			struct interval_node *ny =
+				container_of(y, struct interval_node, node);
+			asrt(nx->lo == ny->lo && nx->hi == ny->hi, "loaded");
+		}
+		asrt(!rb_iter_next(&b, &y), "loaded too long");
+		test_interval_query_sweep(&L, (long long int[]){ 0, 0x40 });
+
+		free(ln);
+		remove(path);
+
+		/* shrink T to the size tested in the next round */
+		for (int i = len - 1; i >= 0 && i >= len - 0x40; --i) {
+			rb_delete(&T, &n[i].node);
+		}
+	}
+
+	struct rb_integer_node m[100];
+	rb_tree_init(&T, &rb_integer_ops);
+	for (int i = 0; i < 100; ++i) {
+		m[i].val = (i * 37) % 100;
+		rb_insert(&T, &m[i].node);
+	}
+	const char *path = "test_tree_save_load_int.bin";
+	asrt(rb_integer_save(&T, path), "rb_integer_save");
+	struct rb_tree L;
+	struct rb_integer_node *lm;
+	int lm_n;
+	rb_tree_init(&L, &rb_integer_ops);
+	asrt(rb_integer_load(&L, path, &lm, &lm_n), "rb_integer_load");
+	asrt(lm_n == 100, "loaded count");
+	check_rb_tree_len(&L, L.root);
+	for (int i = 0; i < 100; ++i) {
+		asrt(lm[i].val == i, "loaded order");
+		asrt(rb_integer_min_greater(&L, i - 1)->val == i, "lookup");
+	}
+	free(lm);
+	remove(path);
+}
+
 int main() {
 	test_interval_overlap();
-	test_rb_tree();
+	test_rb_tree(false);
+	test_rb_tree(true);
+	test_rb_build_threaded();
+	test_rb_tree_batch();
 	test_interval_tree();
+	test_interval_index();
+	test_save_load();
 }
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
+#include "../core.h"
+#include <ds/vec.h>
+#include <ds/vec_file.h>
+#include <stdio.h>
+#include <string.h>
+
+struct counting {
+	int allocs, frees;
+	size_t live;
+	bool fail; /* fail all new allocations */
+};
+static void *c_alloc(void *ctx, size_t size) {
+	struct counting *c = ctx;
+	if (c->fail) return NULL;
+	++c->allocs;
+	c->live += size;
+	return malloc(size);
+}
+static void *c_realloc(void *ctx, void *ptr, size_t old_size,
+		size_t new_size) {
+	struct counting *c = ctx;
+	if (c->fail) return NULL;
+	if (!ptr) ++c->allocs;
+	c->live += new_size - old_size;
+	return realloc(ptr, new_size);
+}
+static void c_free(void *ctx, void *ptr, size_t size) {
+	struct counting *c = ctx;
+	++c->frees;
+	c->live -= size;
+	free(ptr);
+}
+
+static void test_alloc() {
+	struct counting c = { 0 };
+	struct allocator a = {
+		.alloc = c_alloc, .realloc = c_realloc, .free = c_free,
+		.ctx = &c
+	};
+
+	struct vec v = vec_new_with_alloc(sizeof(int), &a);
+	for (int i = 0; i < 1000; ++i) {
+		asrt(vec_append(&v, &i) == i, "vec_append");
+	}
+	struct vec w = vec_copy(&v);
+	asrt(w.alloc == &a, "vec_copy allocator");
+	for (int i = 0; i < 1000; ++i) {
+		asrt(*(int *)vec_get(&w, i) == i, "vec_copy content");
+	}
+	vec_free(&v);
+	vec_free(&w);
+
+	struct str s = str_new_with_alloc(&a);
+	for (int i = 0; i < 100; ++i) {
+		asrt(str_append(&s, "hello", 5), "str_append");
+	}
+	struct str t = str_copy(&s);
+	asrt(strcmp(str_cstr(&s), str_cstr(&t)) == 0, "str_copy");
+	str_free(&s);
+	str_free(&t);
+
+	asrt(c.allocs > 0 && c.allocs == c.frees, "alloc/free pairs");
+	asrt(c.live == 0, "block sizes");
+}
+
+static void test_str_inline() {
+	struct counting c = { 0 };
+	struct allocator a = {
+		.alloc = c_alloc, .realloc = c_realloc, .free = c_free,
+		.ctx = &c
+	};
+	asrt(sizeof(struct str) == sizeof(struct vec), "str size");
+
+	/* short strings never touch the allocator */
+	struct str s = str_new_with_alloc(&a);
+	asrt(str_append(&s, "abc", 3), "");
+	struct str t = str_copy(&s);
+	asrt(strcmp(str_cstr(&t), "abc") == 0 && str_len(&t) == 3, "");
+	str_free(&s);
+	str_free(&t);
+	asrt(c.allocs == 0, "inline str allocated");
+
+	/* grow one char at a time across the inline limit and compare */
+	char ref[200];
+	s = str_new_with_alloc(&a);
+	asrt(str_cstr(&s)[0] == '\0' && !str_any(&s), "empty");
+	for (int i = 0; i < 100; ++i) {
+		ref[i] = 'a' + i % 26;
+		ref[i + 1] = '\0';
+		asrt(str_append_char(&s, ref[i]), "");
+		asrt(str_len(&s) == i + 1, "str_len");
+		asrt(strcmp(str_cstr(&s), ref) == 0, "contents");
+		asrt(s.v.alloc == &a, "allocator kept");
+
+		struct str u = str_copy(&s);
+		asrt(strcmp(str_cstr(&u), ref) == 0, "str_copy");
+		str_free(&u);
+	}
+	str_clear(&s);
+	asrt(!str_any(&s) && strcmp(str_cstr(&s), "") == 0, "str_clear");
+	str_free(&s);
+
+	/* appending a string to itself, while it moves to the heap */
+	for (int len = 1; len <= STR_INLINE_CAP; ++len) {
+		s = str_new_empty();
+		for (int i = 0; i < len; ++i) {
+			str_append_char(&s, '0' + i % 10);
+		}
+		memcpy(ref, str_cstr(&s), len);
+		memcpy(ref + len, str_cstr(&s), len);
+		ref[2 * len] = '\0';
+		asrt(str_append(&s, str_cstr(&s), len), "");
+		asrt(strcmp(str_cstr(&s), ref) == 0, "self append");
+		str_free(&s);
+	}
+
+	s = str_new_from_cstr("hello world, this is longer than inline");
+	str_clear(&s);
+	str_append(&s, "x", 1);
+	asrt(strcmp(str_cstr(&s), "x") == 0, "reuse heap str");
+	str_free(&s);
+
+	asrt(c.allocs == c.frees && c.live == 0, "alloc/free pairs");
+}
+
+static bool keep_odd(const void *item, void *env) {
+	++*(int *)env;
+	return *(const int *)item % 2;
+}
+
+static void test_bulk() {
+	struct vec v = vec_new_empty(sizeof(int));
+	int a[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+
+	/* nothing to insert, into a vec without storage */
+	asrt(vec_insert_range(&v, 0, NULL, 0) && v.len == 0, "empty insert");
+	asrt(vec_insert_range(&v, 0, a + 5, 5), "");
+	asrt(vec_insert_range(&v, 0, a, 3), "");
+	asrt(vec_insert_range(&v, 3, a + 3, 2), "");
+	asrt(vec_insert_range(&v, v.len, a, 0), "");
+	asrt(v.len == 10, "insert len");
+	for (int i = 0; i < 10; ++i) {
+		asrt(*(int *)vec_get(&v, i) == i, "insert order");
+	}
+
+	vec_remove_range(&v, 2, 3);
+	vec_remove_range(&v, v.len, 0);
+	int exp_rem[] = { 0, 1, 5, 6, 7, 8, 9 };
+	asrt(v.len == 7, "remove_range len");
+	for (int i = 0; i < 7; ++i) {
+		asrt(*(int *)vec_get(&v, i) == exp_rem[i], "remove_range");
+	}
+
+	vec_swap_remove(&v, 1);
+	vec_swap_remove(&v, v.len - 1);
+	int exp_swap[] = { 0, 9, 5, 6, 7 };
+	asrt(v.len == 5, "swap_remove len");
+	for (int i = 0; i < 5; ++i) {
+		asrt(*(int *)vec_get(&v, i) == exp_swap[i], "swap_remove");
+	}
+
+	vec_clear(&v);
+	for (int i = 0; i < 1000; ++i) {
+		int x = i / 3;
+		vec_append(&v, &x);
+	}
+	int calls = 0;
+	asrt(vec_retain(&v, keep_odd, &calls) == 501, "retain count");
+	asrt(calls == 1000, "retain calls");
+	int prev = -1;
+	for (int i = 0; i < v.len; ++i) {
+		int x = *(int *)vec_get(&v, i);
+		asrt(x % 2 == 1 && x >= prev, "retain order");
+		prev = x;
+	}
+	vec_free(&v);
+}
+
+static void test_str_builder() {
+	struct counting c = { 0 };
+	struct allocator a = {
+		.alloc = c_alloc, .realloc = c_realloc, .free = c_free,
+		.ctx = &c
+	};
+	struct str_builder b = str_builder_new(&a);
+	struct str ref = str_new_empty();
+
+	/* a mix of small appends and ones bigger than a block */
+	static char buf[3 * STR_BUILDER_BLOCK];
+	for (int i = 0; i < (int)sizeof(buf); ++i) buf[i] = 'a' + i % 23;
+	for (int i = 0; i < 200; ++i) {
+		int l = i % 50 == 49 ? sizeof(buf) - i : (i * 977) % 4096;
+		asrt(str_builder_append(&b, buf + i, l), "append");
+		str_append(&ref, buf + i, l);
+	}
+	asrt(str_builder_len(&b) == str_len(&ref), "len");
+
+	/* a failed append leaves the contents as they were */
+	c.fail = true;
+	asrt(!str_builder_append(&b, buf, STR_BUILDER_BLOCK), "failed append");
+	c.fail = false;
+	asrt(str_builder_len(&b) == str_len(&ref), "len after failure");
+
+	struct str flat;
+	asrt(str_builder_flatten(&b, &flat), "flatten");
+	asrt(str_len(&flat) == str_len(&ref), "flatten len");
+	asrt(memcmp(str_cstr(&flat), str_cstr(&ref), str_len(&ref)) == 0,
+		"flatten contents");
+	str_free(&flat);
+
+	FILE *f = tmpfile();
+	asrt(f, "tmpfile");
+	asrt(str_builder_write(&b, fileno(f)), "write");
+	rewind(f);
+	char *back = malloc(str_len(&ref) + 1);
+	asrt(fread(back, 1, str_len(&ref) + 1, f) == str_len(&ref),
+		"write len");
+	asrt(memcmp(back, str_cstr(&ref), str_len(&ref)) == 0,
+		"write contents");
+	free(back);
+	fclose(f);
+
+	str_builder_free(&b);
+	asrt(str_builder_len(&b) == 0, "free");
+	str_free(&ref);
+	asrt(c.allocs == c.frees && c.live == 0, "alloc/free pairs");
+}
+
+struct point { float x, y; };
+DS_VEC_DEFINE(vec_point, struct point)
+DS_VEC_DEFINE(vec_int, int)
+
+static void test_typed() {
+	struct counting c = { 0 };
+	struct allocator a = {
+		.alloc = c_alloc, .realloc = c_realloc, .free = c_free,
+		.ctx = &c
+	};
+
+	struct vec_int v = vec_int_new(&a);
+	for (int i = 0; i < 1000; ++i) asrt(vec_int_push(&v, i), "push");
+	asrt(v.len == 1000 && v.v.len == 1000, "len");
+	for (int i = 0; i < 1000; ++i) {
+		asrt(v.d[i] == i && *vec_int_get(&v, i) == i, "get");
+		asrt(*(int *)vec_get(&v.v, i) == i, "untyped get");
+	}
+
+	/* the untyped functions work on the same storage */
+	int more[] = { -1, -2, -3 };
+	asrt(vec_append_multiple(&v.v, more, 3), "");
+	asrt(v.len == 1003 && v.d[1002] == -3, "untyped append");
+	asrt(vec_int_pop(&v) == -3 && v.len == 1002, "pop");
+
+	asrt(vec_int_reserve(&v, 5000) && v.cap >= 5000, "reserve");
+	int *d = v.d;
+	while (v.len < 5000) vec_int_push(&v, 0);
+	asrt(v.d == d, "no realloc after reserve");
+	vec_int_free(&v);
+
+	struct vec_point p = vec_point_new(NULL);
+	for (int i = 0; i < 100; ++i) {
+		vec_point_push(&p, (struct point){ .x = i, .y = -i });
+	}
+	asrt(p.itemsize == sizeof(struct point), "itemsize");
+	for (int i = 0; i < 100; ++i) {
+		asrt(p.d[i].x == i && p.d[i].y == -i, "struct elements");
+	}
+	vec_point_free(&p);
+
+	asrt(c.allocs == c.frees && c.live == 0, "alloc/free pairs");
+}
+
+static void test_file() {
+	const char *path = "test_vec_file.bin";
+	remove(path);
+
+	struct vec_file f;
+	asrt(vec_file_open(&f, path, sizeof(long long)), "create");
+	asrt(f.v.len == 0, "new file");
+	for (long long i = 0; i < 100000; ++i) {
+		asrt(vec_append(&f.v, &i) == i, "append");
+	}
+	vec_remove(&f.v, 0);
+	asrt(vec_file_close(&f), "close");
+
+	asrt(vec_file_open(&f, path, sizeof(long long)), "reopen");
+	asrt(f.v.len == 99999, "persisted len");
+	for (int i = 0; i < f.v.len; ++i) {
+		asrt(*(long long *)vec_get(&f.v, i) == i + 1, "persisted data");
+	}
+	long long more[1000];
+	for (int i = 0; i < 1000; ++i) more[i] = -i;
+	asrt(vec_append_multiple(&f.v, more, 1000), "append more");
+	asrt(*(long long *)vec_get(&f.v, 100998) == -999, "");
+
+	/* a copy goes to memory, and is independent of the file */
+	struct vec c = vec_copy(&f.v);
+	asrt(c.len == f.v.len && c.d != f.v.d, "copy");
+	asrt(memcmp(c.d, f.v.d, c.len * c.itemsize) == 0, "copy contents");
+	long long x = 7;
+	asrt(vec_append(&c, &x) == f.v.len, "append to copy");
+	*(long long *)vec_get(&c, 0) = -1;
+	asrt(*(long long *)vec_get(&f.v, 0) == 1, "copy is separate");
+	vec_free(&c);
+	asrt(vec_file_close(&f), "close");
+
+	asrt(!vec_file_open(&f, path, sizeof(int)), "wrong itemsize");
+	asrt(vec_file_open(&f, path, sizeof(long long)), "reopen");
+	asrt(f.v.len == 100999, "len");
+	asrt(vec_file_close(&f), "close");
+	remove(path);
+}
+
+int main() {
+	test_alloc();
+	test_str_inline();
+	test_bulk();
+	test_str_builder();
+	test_typed();
+	test_file();
+}
@@ -1,4 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-only
+#include <limits.h>
+
 #include <ds/tree.h>
 #include "core.h"
 
@@ -18,8 +20,33 @@ enum side {
 
 void rb_tree_init(struct rb_tree *T, struct rb_tree_ops *ops) {
 	T->nil = (struct rb_node){ .color = BLACK };
+	T->nil_link[0] = T->nil_link[1] = &T->nil;
 	T->root = &T->nil;
 	T->ops = ops;
+	T->batch = false;
+	T->threaded = false;
+}
+void rb_tree_init_threaded(struct rb_tree *T, struct rb_tree_ops *ops) {
+	rb_tree_init(T, ops);
+	T->threaded = true;
+}
+
+/* The in-order neighbour of x on side in a threaded tree, T->nil being the
+ * head of the list. */
+static struct rb_node **link(struct rb_tree *T, struct rb_node *x, int side) {
+	if (x == &T->nil) return &T->nil_link[side];
+	struct rb_threaded_node *t =
+		container_of(x, struct rb_threaded_node, node);
+	return &t->link[side];
+}
+
+/* Maintains the invariant that the ancestors of a dirty node are all dirty,
+ * so the walk can stop at the first node that is already marked. */
+static void mark_dirty(struct rb_tree *T, struct rb_node *x) {
+	while (x != &T->nil && !x->dirty) {
+		x->dirty = true;
+		x = x->p;
+	}
 }
 
 static void rotate(struct rb_tree *T, struct rb_node *x, enum side side) {
@@ -38,8 +65,13 @@ static void rotate(struct rb_tree *T, struct rb_node *x, enum side side) {
 	x->p = y;
 
 	if (T->ops->update) {
-		T->ops->update(T, x);
-		T->ops->update(T, y);
+		if (T->batch) {
+			x->dirty = true;
+			mark_dirty(T, y);
+		} else {
+			T->ops->update(T, x);
+			T->ops->update(T, y);
+		}
 	}
 }
 
@@ -72,19 +104,32 @@ void rb_insert(struct rb_tree *T, struct rb_node *z) {
 		x = x->child[!T->ops->lt(z, x)];
 	}
 	z->p = y;
+	enum side side = LEFT;
 	if (y == &T->nil) {
 		T->root = z;
 	} else {
-		y->child[!T->ops->lt(z, y)] = z;
+		side = !T->ops->lt(z, y);
+		y->child[side] = z;
 	}
 	z->left = z->right = &T->nil;
+	if (T->threaded) {
+		/* z is the new neighbour of y on the side it was attached to */
+		struct rb_node *w = *link(T, y, side);
+		*link(T, z, !side) = y;
+		*link(T, z, side) = w;
+		*link(T, w, !side) = z;
+		*link(T, y, side) = z;
+	}
 	z->color = RED;
+	z->dirty = false;
 
-	if (T->ops->update) {
+	if (T->ops->update && T->batch) {
+		mark_dirty(T, z);
+	} else if (T->ops->update) {
 		struct rb_node *n = z;
-		while ((n = n->p) != &T->nil) {
+		do {
 			T->ops->update(T, n);
-		}
+		} while ((n = n->p) != &T->nil);
 	}
 
 	rb_insert_fixup(T, z);
@@ -163,22 +208,99 @@ void rb_delete(struct rb_tree *T, struct rb_node *z) {
 		y->color = z->color;
 	}
 
-	if (T->ops->update) {
+	if (T->ops->update && T->batch) {
+		mark_dirty(T, x->p);
+		/* y took the place of z, so it gained new ancestors */
+		if (y != z) mark_dirty(T, y);
+	} else if (T->ops->update) {
 		struct rb_node *n = x;
 		while ((n = n->p) != &T->nil) {
 			T->ops->update(T, n);
 		}
 	}
 
+	if (T->threaded) {
+		struct rb_node *prev = *link(T, z, LEFT);
+		struct rb_node *next = *link(T, z, RIGHT);
+		*link(T, prev, RIGHT) = next;
+		*link(T, next, LEFT) = prev;
+	}
+
 	if (y_original_color == BLACK) {
 		rb_delete_fixup(T, x);
 	}
 }
 
+void rb_batch_begin(struct rb_tree *T) {
+	asrt(!T->batch, "batch already open");
+	T->batch = true;
+}
+
+static void rb_batch_flush(struct rb_tree *T, struct rb_node *x) {
+	if (x == &T->nil || !x->dirty) return;
+	rb_batch_flush(T, x->left);
+	rb_batch_flush(T, x->right);
+	T->ops->update(T, x);
+	x->dirty = false;
+}
+void rb_batch_commit(struct rb_tree *T) {
+	asrt(T->batch, "no open batch");
+	T->batch = false;
+	if (T->ops->update) {
+		rb_batch_flush(T, T->root);
+	}
+}
+
+static struct rb_node *rb_build_rec(struct rb_tree *T, char *nodes,
+		size_t stride, int lo, int hi, int depth, int red_depth) {
+	if (lo >= hi) return &T->nil;
+	int mid = lo + (hi - lo) / 2;
+	struct rb_node *x = (struct rb_node *)(nodes + mid * stride);
+	x->left = rb_build_rec(T, nodes, stride, lo, mid, depth + 1,
+		red_depth);
+	x->right = rb_build_rec(T, nodes, stride, mid + 1, hi, depth + 1,
+		red_depth);
+	if (x->left != &T->nil) x->left->p = x;
+	if (x->right != &T->nil) x->right->p = x;
+	x->color = depth == red_depth ? RED : BLACK;
+	x->dirty = false;
+	if (T->ops->update) T->ops->update(T, x);
+	return x;
+}
+void rb_build_sorted(struct rb_tree *T, struct rb_node *nodes, int n,
+		size_t stride) {
+	asrt(T->root == &T->nil, "tree not empty");
+	asrt(!T->batch, "build during batch");
+
+	/* Halving splits give a tree where all the leaves are on the last two
+	 * levels. Every level is black, except for the last one if it is not
+	 * full, that one is red. */
+	int h = 0;
+	while ((2 << h) - 1 < n) ++h;
+	int red_depth = (2 << h) - 1 == n ? -1 : h;
+
+	T->root = rb_build_rec(T, (char *)nodes, stride, 0, n, 0, red_depth);
+	T->root->p = &T->nil;
+
+	if (T->threaded) {
+		struct rb_node *prev = &T->nil;
+		for (int i = 0; i < n; ++i) {
+			struct rb_node *x =
+				(struct rb_node *)((char *)nodes + i * stride);
+			*link(T, x, LEFT) = prev;
+			*link(T, prev, RIGHT) = x;
+			prev = x;
+		}
+		*link(T, prev, RIGHT) = &T->nil;
+		T->nil_link[LEFT] = prev;
+	}
+}
+
 struct rb_iter rb_iter(struct rb_tree *T, enum rb_iter_order order) {
+	bool list = T->threaded && order == RB_ITER_ORDER_IN;
 	return (struct rb_iter){
 		.T = T,
-		.x = T->root,
+		.x = list ? T->nil_link[RIGHT] : T->root,
 		.prev = &T->nil,
 		.order = order,
 	};
@@ -193,6 +315,12 @@ struct rb_iter rb_iter(struct rb_tree *T, enum rb_iter_order order) {
  */
 bool rb_iter_next(struct rb_iter *iter, struct rb_node **res) {
 	struct rb_tree *T = iter->T;
+	if (T->threaded && iter->order == RB_ITER_ORDER_IN) {
+		if (iter->x == &T->nil) return false;
+		*res = iter->x;
+		iter->x = *link(T, iter->x, RIGHT);
+		return true;
+	}
 	while (iter->x != &T->nil) {
 		if (iter->prev == iter->x->p) {
 			iter->prev = iter->x;
@@ -252,7 +380,14 @@ static struct rb_node *rb_minimum(struct rb_tree *T, struct rb_node *x) {
 	while (x->left != &T->nil) x = x->left;
 	return x;
 }
+static struct rb_node *rb_maximum(struct rb_tree *T, struct rb_node *x) {
+	while (x->right != &T->nil) x = x->right;
+	return x;
+}
 struct rb_node *rb_successor(struct rb_tree *T, struct rb_node *x) {
+	if (T->threaded) {
+		return *link(T, x, RIGHT);
+	}
 	if (x->right != &T->nil) {
 		return rb_minimum(T, x->right);
 	}
@@ -263,6 +398,20 @@ struct rb_node *rb_successor(struct rb_tree *T, struct rb_node *x) {
 	}
 	return y;
 }
+struct rb_node *rb_predecessor(struct rb_tree *T, struct rb_node *x) {
+	if (T->threaded) {
+		return *link(T, x, LEFT);
+	}
+	if (x->left != &T->nil) {
+		return rb_maximum(T, x->left);
+	}
+	struct rb_node *y = x->p;
+	while (y != &T->nil && x == y->left) {
+		x = y;
+		y = y->p;
+	}
+	return y;
+}
 
 /* note: z does not have to be in the tree, it's only passed to lt */
 static struct rb_node *rb_min_greater(struct rb_tree *T, struct rb_node *z) {
@@ -307,13 +456,16 @@ int interval_lt(struct rb_node *a, struct rb_node *b) {
 }
 void interval_update(struct rb_tree *T, struct rb_node *x) {
 	struct interval_node *nx = container_of(x, struct interval_node, node);
-	nx->max_hi = nx->hi;
+	nx->max_hi = nx->min_hi = nx->hi;
+	nx->count = 1;
 	for (int i = 0; i < 2; ++i) {
 		struct rb_node *c = x->child[i];
 		if (c == &T->nil) continue;
 		struct interval_node *nc =
 			container_of(c, struct interval_node, node);
 		if (nx->max_hi < nc->max_hi) nx->max_hi = nc->max_hi;
+		if (nx->min_hi > nc->min_hi) nx->min_hi = nc->min_hi;
+		nx->count += nc->count;
 	}
 }
 struct rb_tree_ops interval_ops = {
@@ -327,6 +479,7 @@ bool interval_overlap(const long long int a[static 2],
 
 struct interval_iter interval_iter(struct rb_tree *T,
 		const long long int ran[static 2]) {
+	asrt(!T->batch, "interval query during batch");
 	return (struct interval_iter){
 		.T = T,
 		.x = T->root,
@@ -417,3 +570,225 @@ struct interval_node *interval_min_greater(struct rb_tree *T,
 		return NULL;
 	}
 }
+
+/* lo_ok: every lo in the subtree is known to be < ran[1] */
+static int interval_count_rec(struct rb_tree *T, struct rb_node *x,
+		const long long int ran[static 2], bool lo_ok) {
+	if (x == &T->nil) return 0;
+	struct interval_node *nx = container_of(x, struct interval_node, node);
+	if (nx->max_hi <= ran[0]) return 0;
+	if (lo_ok && nx->min_hi > ran[0]) return nx->count;
+
+	/* the left subtree has lo <= nx->lo, the right one lo >= nx->lo */
+	int n = interval_count_rec(T, x->left, ran, nx->lo < ran[1]);
+	if (nx->lo >= ran[1]) return n;
+	if (interval_overlap(ran, nx->ran)) ++n;
+	return n + interval_count_rec(T, x->right, ran, lo_ok);
+}
+int interval_count(struct rb_tree *T, const long long int ran[static 2]) {
+	asrt(!T->batch, "interval query during batch");
+	return interval_count_rec(T, T->root, ran, false);
+}
+
+/* events are ordered by key, a lo before a hi at the same key */
+static int event_lt(struct rb_node *a, struct rb_node *b) {
+	struct interval_event *ea = container_of(a, struct interval_event, node);
+	struct interval_event *eb = container_of(b, struct interval_event, node);
+	return ea->key < eb->key
+		|| (ea->key == eb->key && ea->delta > eb->delta);
+}
+
+/* Adds len at depth to a minimum depth summary. */
+static void depth_min(int *min_depth, long long int *min_len, int depth,
+		long long int len) {
+	if (depth < *min_depth) {
+		*min_depth = depth;
+		*min_len = len;
+	} else if (depth == *min_depth) {
+		*min_len += len;
+	}
+}
+static void event_update(struct rb_tree *T, struct rb_node *x) {
+	struct interval_event *ex = container_of(x, struct interval_event, node);
+	struct interval_event *el = x->left != &T->nil
+		? container_of(x->left, struct interval_event, node) : NULL;
+	struct interval_event *er = x->right != &T->nil
+		? container_of(x->right, struct interval_event, node) : NULL;
+
+	/* the left subtree, x, then the right subtree, in key order */
+	int depth = 0;
+	ex->min_depth = INT_MAX;
+	ex->min_len = 0;
+	ex->min_key = ex->max_key = ex->key;
+	ex->his = ex->delta < 0;
+	if (el) {
+		ex->min_depth = el->min_depth;
+		ex->min_len = el->min_len;
+		depth = el->sum;
+		depth_min(&ex->min_depth, &ex->min_len, depth,
+			ex->key - el->max_key);
+		ex->min_key = el->min_key;
+		ex->his += el->his;
+	}
+	depth += ex->delta;
+	if (er) {
+		depth_min(&ex->min_depth, &ex->min_len, depth,
+			er->min_key - ex->key);
+		if (er->min_depth != INT_MAX) {
+			depth_min(&ex->min_depth, &ex->min_len,
+				depth + er->min_depth, er->min_len);
+		}
+		depth += er->sum;
+		ex->max_key = er->max_key;
+		ex->his += er->his;
+	}
+	ex->sum = depth;
+}
+static struct rb_tree_ops interval_event_ops = {
+	.lt = event_lt, .update = event_update
+};
+
+void interval_index_init(struct interval_index *I) {
+	rb_tree_init(&I->by_lo, &interval_ops);
+	rb_tree_init(&I->events, &interval_event_ops);
+}
+void interval_index_insert(struct interval_index *I,
+		struct interval_index_node *z) {
+	asrt(z->iv.lo <= z->iv.hi, "inverted interval");
+	rb_insert(&I->by_lo, &z->iv.node);
+	for (int i = 0; i < 2; ++i) {
+		z->ev[i].key = z->iv.ran[i];
+		z->ev[i].delta = i ? -1 : 1;
+		rb_insert(&I->events, &z->ev[i].node);
+	}
+}
+void interval_index_delete(struct interval_index *I,
+		struct interval_index_node *z) {
+	rb_delete(&I->by_lo, &z->iv.node);
+	for (int i = 0; i < 2; ++i) rb_delete(&I->events, &z->ev[i].node);
+}
+
+/* number of intervals with lo < r */
+static int count_lo_less(struct rb_tree *T, long long int r) {
+	int n = 0;
+	for (struct rb_node *x = T->root; x != &T->nil; ) {
+		struct interval_node *nx =
+			container_of(x, struct interval_node, node);
+		if (nx->lo < r) {
+			if (x->left != &T->nil) {
+				struct interval_node *nl = container_of(
+					x->left, struct interval_node, node);
+				n += nl->count;
+			}
+			++n;
+			x = x->right;
+		} else {
+			x = x->left;
+		}
+	}
+	return n;
+}
+/* number of intervals with hi <= l */
+static int count_hi_le(struct rb_tree *T, long long int l) {
+	int n = 0;
+	for (struct rb_node *x = T->root; x != &T->nil; ) {
+		struct interval_event *ex =
+			container_of(x, struct interval_event, node);
+		if (ex->key <= l) {
+			if (x->left != &T->nil) {
+				struct interval_event *el = container_of(
+					x->left, struct interval_event, node);
+				n += el->his;
+			}
+			n += ex->delta < 0;
+			x = x->right;
+		} else {
+			x = x->left;
+		}
+	}
+	return n;
+}
+int interval_index_count(struct interval_index *I,
+		const long long int ran[static 2]) {
+	asrt(!I->by_lo.batch && !I->events.batch,
+		"interval query during batch");
+	/* for l < r, hi <= l implies lo <= l < r */
+	if (ran[0] >= ran[1]) return 0;
+	return count_lo_less(&I->by_lo, ran[1])
+		- count_hi_le(&I->events, ran[0]);
+}
+
+/*
+ * The covered length of (-inf, t). The depth (number of intervals covering a
+ * point) is the running sum of the deltas of the events before it, and it is
+ * never negative, so a gap between events is uncovered exactly when its depth
+ * is 0, which can only be the minimum depth of the subtree it is in.
+ */
+static long long int covered_before(struct rb_tree *T, long long int t) {
+	long long int sum = 0, last = 0;
+	int depth = 0;
+	bool any = false; /* last is the key of the previous event */
+	for (struct rb_node *x = T->root; x != &T->nil; ) {
+		struct interval_event *ex =
+			container_of(x, struct interval_event, node);
+		if (ex->key >= t) {
+			x = x->left;
+			continue;
+		}
+		if (x->left != &T->nil) {
+			struct interval_event *el = container_of(
+				x->left, struct interval_event, node);
+			if (any && depth > 0) sum += el->min_key - last;
+			sum += el->max_key - el->min_key;
+			if (el->min_depth != INT_MAX
+					&& depth + el->min_depth == 0) {
+				sum -= el->min_len;
+			}
+			depth += el->sum;
+			last = el->max_key;
+			any = true;
+		}
+		if (any && depth > 0) sum += ex->key - last;
+		depth += ex->delta;
+		last = ex->key;
+		any = true;
+		x = x->right;
+	}
+	if (any && depth > 0) sum += t - last;
+	return sum;
+}
+long long int interval_index_covered(struct interval_index *I,
+		const long long int ran[static 2]) {
+	asrt(!I->events.batch, "interval query during batch");
+	if (ran[0] >= ran[1]) return 0;
+	return covered_before(&I->events, ran[1])
+		- covered_before(&I->events, ran[0]);
+}
+
+/* In-order sweep, *end is the end of the covered prefix of ran. */
+static void interval_covered_rec(struct rb_tree *T, struct rb_node *x,
+		const long long int ran[static 2], long long int *end,
+		long long int *sum) {
+	if (x == &T->nil || *end >= ran[1]) return;
+	struct interval_node *nx = container_of(x, struct interval_node, node);
+	if (nx->max_hi <= *end) return;
+
+	interval_covered_rec(T, x->left, ran, end, sum);
+	if (nx->lo >= ran[1] || *end >= ran[1]) return;
+
+	long long int lo = nx->lo > *end ? nx->lo : *end;
+	long long int hi = nx->hi < ran[1] ? nx->hi : ran[1];
+	if (lo < hi) {
+		*sum += hi - lo;
+		*end = hi;
+	}
+
+	interval_covered_rec(T, x->right, ran, end, sum);
+}
+long long int interval_covered(struct rb_tree *T,
+		const long long int ran[static 2]) {
+	asrt(!T->batch, "interval query during batch");
+	long long int end = ran[0], sum = 0;
+	interval_covered_rec(T, T->root, ran, &end, &sum);
+	return sum;
+}
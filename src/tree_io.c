@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ds/tree.h>
+
+/*
+ * File layout:
+ *   struct header
+ *   n records of `width` long long ints, in increasing key order
+ */
+
+static const char magic[4] = { 'd', 's', 'r', 'b' };
+
+enum kind {
+	KIND_INTEGER = 1, /* record: val */
+	KIND_INTERVAL = 2, /* record: lo, hi */
+};
+
+struct header {
+	char magic[4];
+	uint32_t kind;
+	uint64_t n;
+};
+
+static bool save(struct rb_tree *T, const char *path, enum kind kind,
+		size_t key_offset, int width) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+
+	struct header h = { .kind = kind, .n = 0 };
+	memcpy(h.magic, magic, sizeof(magic));
+	if (fwrite(&h, sizeof(h), 1, f) != 1) goto err;
+
+	struct rb_iter iter = rb_iter(T, RB_ITER_ORDER_IN);
+	struct rb_node *x;
+	while (rb_iter_next(&iter, &x)) {
+		/* the keys are stored key_offset bytes before the node */
+		const char *rec = (const char *)x - key_offset;
+		if (fwrite(rec, sizeof(long long int), width, f) != width) {
+			goto err;
+		}
+		++h.n;
+	}
+
+	/* now that we know the count, rewrite the header */
+	if (fseek(f, 0, SEEK_SET) != 0) goto err;
+	if (fwrite(&h, sizeof(h), 1, f) != 1) goto err;
+	return fclose(f) == 0;
+err:
+	fclose(f);
+	return false;
+}
+
+/* Maps the file and returns a pointer to the records, or NULL on error. */
+static const long long int *map(const char *path, enum kind kind, int width,
+		void **addr, size_t *size, int *n) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct header)) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	*addr = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (*addr == MAP_FAILED) return NULL;
+	posix_madvise(*addr, *size, POSIX_MADV_SEQUENTIAL);
+
+	const struct header *h = *addr;
+	size_t rec_size = width * sizeof(long long int);
+	if (memcmp(h->magic, magic, sizeof(magic)) != 0 || h->kind != kind
+			|| h->n > (*size - sizeof(*h)) / rec_size
+			|| h->n != (int)h->n) {
+		munmap(*addr, *size);
+		return NULL;
+	}
+	*n = h->n;
+	return (const long long int *)(h + 1);
+}
+
+bool rb_integer_save(struct rb_tree *T, const char *path) {
+	return save(T, path, KIND_INTEGER,
+		offsetof(struct rb_integer_node, node)
+		- offsetof(struct rb_integer_node, val), 1);
+}
+
+bool rb_integer_load(struct rb_tree *T, const char *path,
+		struct rb_integer_node **nodes, int *n) {
+	void *addr;
+	size_t size;
+	const long long int *rec = map(path, KIND_INTEGER, 1, &addr, &size, n);
+	if (!rec) return false;
+
+	*nodes = malloc(*n * sizeof(**nodes));
+	if (!*nodes && *n > 0) {
+		munmap(addr, size);
+		return false;
+	}
+	for (int i = 0; i < *n; ++i) {
+		(*nodes)[i].val = rec[i];
+	}
+	munmap(addr, size);
+
+	if (*n > 0) rb_build_sorted(T, &(*nodes)->node, *n, sizeof(**nodes));
+	return true;
+}
+
+bool interval_save(struct rb_tree *T, const char *path) {
+	return save(T, path, KIND_INTERVAL,
+		offsetof(struct interval_node, node)
+		- offsetof(struct interval_node, ran), 2);
+}
+
+bool interval_load(struct rb_tree *T, const char *path,
+		struct interval_node **nodes, int *n) {
+	void *addr;
+	size_t size;
+	const long long int *rec = map(path, KIND_INTERVAL, 2, &addr, &size, n);
+	if (!rec) return false;
+
+	*nodes = malloc(*n * sizeof(**nodes));
+	if (!*nodes && *n > 0) {
+		munmap(addr, size);
+		return false;
+	}
+	for (int i = 0; i < *n; ++i) {
+		(*nodes)[i].lo = rec[2 * i];
+		(*nodes)[i].hi = rec[2 * i + 1];
+	}
+	munmap(addr, size);
+
+	if (*n > 0) rb_build_sorted(T, &(*nodes)->node, *n, sizeof(**nodes));
+	return true;
+}
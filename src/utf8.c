@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_DISPATCH
+#include <tmmintrin.h>
+#endif
+
+#include <ds/iter.h>
+#include "core.h"
+#include "iter_internal.h"
+
+/*
+ * Decodes the codepoint at d[0, len), len > 0. Returns its length, and the
+ * codepoint in *cp, or -1 for an invalid sequence (then the length is 1).
+ * Rejects overlong forms, surrogates and values over U+10FFFF.
+ */
+static int decode(const unsigned char *d, int len, int32_t *cp) {
+	unsigned char c = d[0];
+	int n;
+	int32_t v, min;
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	} else if (c >= 0xc2 && c <= 0xdf) {
+		n = 2, v = c & 0x1f, min = 0x80;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		n = 3, v = c & 0x0f, min = 0x800;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		n = 4, v = c & 0x07, min = 0x10000;
+	} else {
+		*cp = -1;
+		return 1;
+	}
+	if (n > len) {
+		*cp = -1;
+		return 1;
+	}
+	for (int i = 1; i < n; ++i) {
+		if ((d[i] & 0xc0) != 0x80) {
+			*cp = -1;
+			return 1;
+		}
+		v = (v << 6) | (d[i] & 0x3f);
+	}
+	if (v < min || v > 0x10ffff || (v >= 0xd800 && v <= 0xdfff)) {
+		*cp = -1;
+		return 1;
+	}
+	*cp = v;
+	return n;
+}
+
+static bool valid_scalar(const unsigned char *d, int len) {
+	int i = 0;
+	while (i < len) {
+		/* skip ASCII 8 bytes at a time */
+		if (i + 8 <= len) {
+			uint64_t w;
+			memcpy(&w, d + i, 8);
+			if (!(w & 0x8080808080808080ull)) {
+				i += 8;
+				continue;
+			}
+		}
+		int32_t cp;
+		i += decode(d + i, len - i, &cp);
+		if (cp < 0) return false;
+	}
+	return true;
+}
+
+#ifdef HAVE_SSSE3_DISPATCH
+/*
+ * The lookup algorithm of John Keiser and Daniel Lemire, "Validating UTF-8 In
+ * Less Than One Instruction Per Byte", Software: Practice and Experience
+ * 51(5), 2021. Each byte and its predecessor are classified by three 16 entry
+ * table lookups (on the high nibble of the previous byte, its low nibble, and
+ * the high nibble of the current one); the AND of the results is non-zero
+ * exactly for the invalid 2 byte combinations. The remaining errors (missing
+ * or extra continuation bytes after 3 and 4 byte leads) are checked by
+ * looking 2 and 3 bytes back.
+ */
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i check_block(__m128i in, __m128i prev) {
+	const __m128i byte_1_high_tbl = _mm_setr_epi8(
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	const __m128i byte_1_low_tbl = _mm_setr_epi8(
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+		CARRY | OVERLONG_2,
+		CARRY,
+		CARRY,
+		CARRY | TOO_LARGE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000);
+	const __m128i byte_2_high_tbl = _mm_setr_epi8(
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3
+			| TOO_LARGE_1000 | OVERLONG_4,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+
+	__m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+	__m128i b1h = _mm_shuffle_epi8(byte_1_high_tbl,
+		_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+	__m128i b1l = _mm_shuffle_epi8(byte_1_low_tbl,
+		_mm_and_si128(prev1, nibble));
+	__m128i b2h = _mm_shuffle_epi8(byte_2_high_tbl,
+		_mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+	__m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+	/* 3rd and 4th bytes of 3 and 4 byte sequences must be continuations */
+	__m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+	__m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+	__m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80));
+	__m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80));
+	__m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth),
+		_mm_set1_epi8(0x80));
+	return _mm_xor_si128(must23, special);
+}
+
+__attribute__((target("ssse3")))
+static bool valid_ssse3(const unsigned char *d, int len) {
+	/* non-zero if the last block ended in the middle of a sequence */
+	const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1);
+	__m128i err = _mm_setzero_si128(), prev = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(d + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(d + i + 16));
+		if (!_mm_movemask_epi8(_mm_or_si128(a, b))) {
+			/* ASCII: only an incomplete sequence before is wrong */
+			err = _mm_or_si128(err, _mm_subs_epu8(prev, max));
+		} else {
+			err = _mm_or_si128(err, check_block(a, prev));
+			err = _mm_or_si128(err, check_block(b, a));
+		}
+		prev = b;
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(err,
+				_mm_setzero_si128())) != 0xffff) {
+			return false;
+		}
+	}
+
+	/* the rest, padded with zeros (ASCII), which also catches a sequence
+	 * that is cut off by the end */
+	unsigned char tail[48] = { 0 };
+	memcpy(tail, d + i, len - i);
+	for (int j = 0; j < 48; j += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(tail + j));
+		err = _mm_or_si128(err, check_block(a, prev));
+		prev = a;
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128()))
+		== 0xffff;
+}
+#endif
+
+bool str_slice_utf8_valid(struct str_slice s) {
+	const unsigned char *d = (const unsigned char *)s.d;
+#ifdef HAVE_SSSE3_DISPATCH
+	if (__builtin_cpu_supports("ssse3")) return valid_ssse3(d, s.len);
+#endif
+	return valid_scalar(d, s.len);
+}
+bool str_utf8_valid(const struct str *s) {
+	return str_slice_utf8_valid(str_as_slice(s));
+}
+
+bool str_gen_codepoints_next(struct str_gen *g, struct str_slice *res) {
+	const unsigned char *d = (const unsigned char *)g->codepoints.s.d;
+	int len = g->codepoints.s.len, i = g->codepoints.i;
+	if (i >= len) return false;
+
+	int n = decode(d + i, len - i, &g->codepoints.cp);
+	*res = (struct str_slice){ .d = (const char *)d + i, .len = n };
+	g->codepoints.i = i + n;
+	return true;
+}
+
+/* Widens the ASCII prefix of d[0, n) into out, returns its length. */
+static int ascii_run(const unsigned char *d, int n, int32_t *out) {
+	int k = 0;
+#ifdef __SSE2__
+	const __m128i z = _mm_setzero_si128();
+	for (; k + 16 <= n; k += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(d + k));
+		if (_mm_movemask_epi8(x)) break;
+		__m128i lo = _mm_unpacklo_epi8(x, z);
+		__m128i hi = _mm_unpackhi_epi8(x, z);
+		__m128i *o = (__m128i *)(out + k);
+		_mm_storeu_si128(o, _mm_unpacklo_epi16(lo, z));
+		_mm_storeu_si128(o + 1, _mm_unpackhi_epi16(lo, z));
+		_mm_storeu_si128(o + 2, _mm_unpacklo_epi16(hi, z));
+		_mm_storeu_si128(o + 3, _mm_unpackhi_epi16(hi, z));
+	}
+#endif
+	for (; k < n && d[k] < 0x80; ++k) out[k] = d[k];
+	return k;
+}
+
+int str_gen_codepoints_bulk(struct str_gen *g, int32_t *out, int n) {
+	asrt(g->kind == STR_GEN_KIND_CODEPOINTS, "not a codepoints generator");
+	const unsigned char *d = (const unsigned char *)g->codepoints.s.d;
+	int len = g->codepoints.s.len, i = g->codepoints.i, k = 0;
+	while (k < n && i < len) {
+		int m = len - i < n - k ? len - i : n - k;
+		int r = ascii_run(d + i, m, out + k);
+		i += r;
+		k += r;
+		if (r < m) i += decode(d + i, len - i, &out[k++]);
+	}
+	if (k > 0) g->codepoints.cp = out[k - 1];
+	g->codepoints.i = i;
+	return k;
+}
+
+struct str_gen str_gen_codepoints(struct str_slice s) {
+	return (struct str_gen){
+		.kind = STR_GEN_KIND_CODEPOINTS,
+		.codepoints = { .s = s, .i = 0, .cp = -1 },
+	};
+}
+int32_t str_gen_codepoint(const struct str_gen *g) {
+	asrt(g->kind == STR_GEN_KIND_CODEPOINTS, "not a codepoints generator");
+	return g->codepoints.cp;
+}
@@ -7,16 +7,32 @@
 
 static int maxi(int a, int b) { return a < b ? b : a; }
 
-const struct str str_empty = { .v = VEC_EMPTY(sizeof(char)) };
+/* Set in the tag byte of inline strings. In heap mode the tag byte is part of
+ * v.itemsize == 1, so the bit is clear there regardless of the byte order. */
+#define STR_INLINE_TAG 0x80
+_Static_assert(offsetof(struct vec, itemsize) + sizeof(size_t)
+	== offsetof(struct vec, alloc), "str tag must overlay itemsize");
+_Static_assert(STR_INLINE_CAP < STR_INLINE_TAG, "str tag too small");
 
-static void vec_realloc(struct vec *v, int new_cap) {
+const struct str str_empty = { .in = { .tag = STR_INLINE_TAG } };
+
+static bool str_is_inline(const struct str *s) {
+	return s->in.tag & STR_INLINE_TAG;
+}
+
+static bool vec_realloc(struct vec *v, int new_cap) {
 	asrt(new_cap > v->len, "wrong len");
-	v->d = realloc(v->d, new_cap * v->itemsize);
+	void *d = allocator_realloc(v->alloc, v->d, v->cap * v->itemsize,
+		new_cap * v->itemsize);
+	if (!d) return false;
+	v->d = d;
 	v->cap = new_cap;
+	return true;
 }
 static void vec_append_multiple_no_realloc(
 		struct vec *v, const void *n, int l) {
 	asrt(v->len + l <= v->cap, "realloc went wrong");
+	if (l == 0) return; /* v->d may be NULL */
 	memcpy(v->d + v->len * v->itemsize, n, l * v->itemsize);
 	v->len += l;
 }
@@ -24,58 +40,125 @@ static void vec_append_multiple_no_realloc(
 struct str str_new_empty() {
 	return str_empty;
 }
+struct str str_new_with_alloc(const struct allocator *alloc) {
+	struct str s = str_empty;
+	s.v.alloc = alloc;
+	return s;
+}
 struct str str_new_from_cstr(const char *cstr) {
 	struct str s = str_empty;
 	str_append(&s, cstr, strlen(cstr));
 	return s;
 }
-void str_append(struct str *s, const char *n, int l) {
+bool str_append(struct str *s, const char *n, int l) {
+	if (str_is_inline(s)) {
+		int len = s->in.tag & ~STR_INLINE_TAG;
+		if (len + l <= STR_INLINE_CAP) {
+			memmove(s->in.d + len, n, l);
+			s->in.d[len + l] = '\0';
+			s->in.tag = STR_INLINE_TAG | (len + l);
+			return true;
+		}
+
+		/* Move to the heap. Build the vec on the side, since n might
+		 * point into the inline buffer. */
+		struct vec v = vec_new_with_alloc(sizeof(char), s->v.alloc);
+		if (!vec_realloc(&v, maxi(2 * (STR_INLINE_CAP + 1),
+				len + l + 1))) {
+			return false;
+		}
+		vec_append_multiple_no_realloc(&v, s->in.d, len);
+		vec_append_multiple_no_realloc(&v, n, l);
+		char *d = v.d;
+		d[v.len] = '\0';
+		s->v = v;
+		return true;
+	}
+
 	if (s->v.len + l + 1 > s->v.cap) {
-		vec_realloc(&s->v, maxi(s->v.cap * 2, s->v.len + l + 1));
+		if (!vec_realloc(&s->v, maxi(s->v.cap * 2, s->v.len + l + 1))) {
+			return false;
+		}
 	}
 	vec_append_multiple_no_realloc(&s->v, n, l);
 	asrt(s->v.len + 1 <= s->v.cap, "bad str len calc");
 	char *d = s->v.d;
 	d[s->v.len] = '\0';
+	return true;
 }
-void str_append_char(struct str *s, char c) {
-	str_append(s, &c, 1);
+bool str_append_char(struct str *s, char c) {
+	return str_append(s, &c, 1);
 }
 const char * str_cstr(const struct str *s) {
+	if (str_is_inline(s)) return s->in.d;
 	if (s->v.len == 0) return ""; // we do this to avoid alloc at init
 	return s->v.d;
 }
+int str_len(const struct str *s) {
+	if (str_is_inline(s)) return s->in.tag & ~STR_INLINE_TAG;
+	return s->v.len;
+}
 struct str str_copy(const struct str *s) {
-	struct str res = str_new_empty();
-	str_append(&res, (const char *)s->v.d, s->v.len);
+	struct str res = str_new_with_alloc(s->v.alloc);
+	str_append(&res, str_cstr(s), str_len(s));
 	return res;
 }
 void str_free(struct str *s) {
-	vec_free(&s->v);
+	if (!str_is_inline(s)) vec_free(&s->v);
 }
 bool str_any(const struct str *s) {
-	return s->v.len > 0;
+	return str_len(s) > 0;
 }
 void str_clear(struct str *s) {
-	if (str_any(s)) {
+	if (str_is_inline(s)) {
+		s->in.d[0] = '\0';
+		s->in.tag = STR_INLINE_TAG;
+	} else if (str_any(s)) {
 		s->v.len = 0;
 		asrt(s->v.cap >= 1, "zero cap");
 		char *d = s->v.d;
 		d[s->v.len] = '\0';
 	}
 }
+bool str_reserve(struct str *s, int cap) {
+	if (str_is_inline(s)) {
+		if (cap <= STR_INLINE_CAP) return true;
+		struct vec v = vec_new_with_alloc(sizeof(char), s->v.alloc);
+		if (!vec_realloc(&v, cap + 1)) return false;
+		int len = str_len(s);
+		vec_append_multiple_no_realloc(&v, s->in.d, len + 1);
+		v.len = len;
+		s->v = v;
+		return true;
+	}
+	if (cap + 1 > s->v.cap) return vec_realloc(&s->v, cap + 1);
+	return true;
+}
 
 struct vec vec_new_empty(size_t itemsize) {
 	return (struct vec){ .d = NULL, .len = 0, .cap = 0, .itemsize = itemsize };
 }
-void vec_append_multiple(struct vec *v, const void *n, int l) {
-	if (v->len + l > v->cap) {
-		vec_realloc(v, maxi(v->cap * 2, v->len + l));
-	}
+struct vec vec_new_with_alloc(size_t itemsize,
+		const struct allocator *alloc) {
+	struct vec v = VEC_EMPTY(itemsize);
+	v.alloc = alloc;
+	return v;
+}
+bool vec_reserve(struct vec *v, int cap) {
+	if (cap > v->cap) return vec_realloc(v, cap);
+	return true;
+}
+bool vec_grow(struct vec *v, int l) {
+	if (v->len + l <= v->cap) return true;
+	return vec_realloc(v, maxi(v->cap * 2, v->len + l));
+}
+bool vec_append_multiple(struct vec *v, const void *n, int l) {
+	if (!vec_grow(v, l)) return false;
 	vec_append_multiple_no_realloc(v, n, l);
+	return true;
 }
 int vec_append(struct vec *v, const void *n) {
-	vec_append_multiple(v, n, 1);
+	if (!vec_append_multiple(v, n, 1)) return -1;
 	return v->len - 1;
 }
 void vec_remove(struct vec *v, int i) {
@@ -86,6 +169,58 @@ void vec_remove(struct vec *v, int i) {
 	}
 	--v->len;
 }
+void vec_swap_remove(struct vec *v, int i) {
+	asrt(i >= 0 && i < v->len, "bad vec index");
+	if (i != v->len - 1) {
+		memcpy(v->d + i * v->itemsize,
+			v->d + (v->len - 1) * v->itemsize, v->itemsize);
+	}
+	--v->len;
+}
+void vec_remove_range(struct vec *v, int i, int l) {
+	asrt(i >= 0 && l >= 0 && i + l <= v->len, "bad vec range");
+	if (v->len > i + l) {
+		memmove(v->d + i * v->itemsize, v->d + (i + l) * v->itemsize,
+			v->itemsize * (v->len - i - l));
+	}
+	v->len -= l;
+}
+bool vec_insert_range(struct vec *v, int i, const void *n, int l) {
+	asrt(i >= 0 && i <= v->len && l >= 0, "bad vec index");
+	if (l == 0) return true; /* v->d may be NULL */
+	if (!vec_grow(v, l)) return false;
+	memmove(v->d + (i + l) * v->itemsize, v->d + i * v->itemsize,
+		v->itemsize * (v->len - i));
+	memcpy(v->d + i * v->itemsize, n, l * v->itemsize);
+	v->len += l;
+	return true;
+}
+/* moves the run [from, to) down to w, returns the new w */
+static int vec_move_run(struct vec *v, int w, int from, int to) {
+	if (from != w) {
+		memmove(v->d + w * v->itemsize, v->d + from * v->itemsize,
+			v->itemsize * (to - from));
+	}
+	return w + to - from;
+}
+int vec_retain(struct vec *v, bool (*keep)(const void *item, void *env),
+		void *env) {
+	/* kept elements are moved down with one memmove per run */
+	int w = 0, run = -1;
+	for (int i = 0; i < v->len; ++i) {
+		if (keep(v->d + i * v->itemsize, env)) {
+			if (run < 0) run = i;
+		} else if (run >= 0) {
+			w = vec_move_run(v, w, run, i);
+			run = -1;
+		}
+	}
+	if (run >= 0) w = vec_move_run(v, w, run, v->len);
+
+	int removed = v->len - w;
+	v->len = w;
+	return removed;
+}
 void * vec_get(struct vec *v, int i) {
 	asrt(i >= 0 && i < v->len, "bad vec index");
 	return v->d + i * v->itemsize;
@@ -95,13 +230,13 @@ const void * vec_get_c(const struct vec *v, int i) {
 	return v->d + i * v->itemsize;
 }
 void vec_free(struct vec *v) {
-	free(v->d);
+	allocator_free(v->alloc, v->d, v->cap * v->itemsize);
 }
 void vec_clear(struct vec *v) {
 	v->len = 0;
 }
 struct vec vec_copy(const struct vec *v) {
-	struct vec c = VEC_EMPTY(v->itemsize);
+	struct vec c = vec_new_with_alloc(v->itemsize, v->alloc);
 	vec_append_multiple(&c, v->d, v->len);
 	return c;
 }
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-3.0-only
+#define _GNU_SOURCE /* mremap */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ds/vec_file.h>
+#include "core.h"
+
+static const char magic[4] = { 'd', 's', 'v', 'f' };
+
+/* padded, so the elements are aligned in the mapping */
+#define HEADER_SIZE 64
+struct header {
+	char magic[4];
+	uint32_t version;
+	uint64_t itemsize;
+	uint64_t len;
+};
+_Static_assert(sizeof(struct header) <= HEADER_SIZE, "header too big");
+
+static char *data(struct vec_file *f) {
+	return (char *)f->map + HEADER_SIZE;
+}
+
+static bool remap(struct vec_file *f, size_t size) {
+	void *m;
+#ifdef MREMAP_MAYMOVE
+	m = mremap(f->map, f->map_size, size, MREMAP_MAYMOVE);
+	if (m == MAP_FAILED) return false;
+#else
+	m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+	if (m == MAP_FAILED) return false;
+	munmap(f->map, f->map_size);
+#endif
+	f->map = m;
+	f->map_size = size;
+	return true;
+}
+
+/* The vec's own storage is the file, everything else (e.g. the storage of
+ * vec_copy results, which inherit the allocator) goes to malloc. */
+static void *file_alloc(void *ctx, size_t size) {
+	return malloc(size);
+}
+static void *file_realloc(void *ctx, void *ptr, size_t old_size,
+		size_t new_size) {
+	struct vec_file *f = ctx;
+	if (ptr != data(f)) return realloc(ptr, new_size);
+	if (new_size <= old_size) return ptr;
+	size_t size = HEADER_SIZE + new_size;
+	if (ftruncate(f->fd, size) != 0) return NULL;
+	/* on failure the file stays longer, which only adds to the cap of the
+	 * next vec_file_open */
+	if (!remap(f, size)) return NULL;
+	return data(f);
+}
+static void file_free(void *ctx, void *ptr, size_t size) {
+	/* the data stays in the file, vec_file_close unmaps it */
+	struct vec_file *f = ctx;
+	if (ptr != data(f)) free(ptr);
+}
+
+bool vec_file_open(struct vec_file *f, const char *path, size_t itemsize) {
+	f->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (f->fd < 0) return false;
+
+	struct stat st;
+	if (fstat(f->fd, &st) != 0) goto err_close;
+	bool created = st.st_size == 0;
+	if (created) {
+		if (ftruncate(f->fd, HEADER_SIZE) != 0) goto err_close;
+		st.st_size = HEADER_SIZE;
+	} else if (st.st_size < HEADER_SIZE) {
+		goto err_close;
+	}
+
+	f->map_size = st.st_size;
+	f->map = mmap(NULL, f->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		f->fd, 0);
+	if (f->map == MAP_FAILED) goto err_close;
+
+	struct header *h = f->map;
+	if (created) {
+		memcpy(h->magic, magic, sizeof(magic));
+		h->version = 1;
+		h->itemsize = itemsize;
+		h->len = 0;
+	}
+	size_t cap = (f->map_size - HEADER_SIZE) / itemsize;
+	if (memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != 1
+			|| h->itemsize != itemsize || h->len > cap
+			|| cap > INT32_MAX) {
+		goto err_unmap;
+	}
+
+	f->alloc = (struct allocator){
+		.alloc = file_alloc,
+		.realloc = file_realloc,
+		.free = file_free,
+		.ctx = f,
+	};
+	f->v = vec_new_with_alloc(itemsize, &f->alloc);
+	f->v.d = data(f);
+	f->v.len = h->len;
+	f->v.cap = cap;
+	return true;
+
+err_unmap:
+	munmap(f->map, f->map_size);
+err_close:
+	close(f->fd);
+	return false;
+}
+
+bool vec_file_sync(struct vec_file *f) {
+	struct header *h = f->map;
+	h->len = f->v.len;
+	return msync(f->map, f->map_size, MS_SYNC) == 0;
+}
+
+bool vec_file_close(struct vec_file *f) {
+	bool ok = vec_file_sync(f);
+	ok = munmap(f->map, f->map_size) == 0 && ok;
+	ok = close(f->fd) == 0 && ok;
+	f->v = VEC_EMPTY(f->v.itemsize);
+	return ok;
+}